@@ -93,6 +93,7 @@ namespace sake
         m_ctx.uc_stack.ss_sp = m_stack;
         m_ctx.uc_stack.ss_size = m_stacksize;
         makecontext(&m_ctx, &Fiber::MainFunc, 0);
+        m_mdc.clear();
         m_state = INIT;
     }
 
@@ -101,6 +102,7 @@ namespace sake
         SetThis(this);
         SAKE_ASSERT(m_state != EXEC);
         m_state = EXEC;
+        LogMdc::SetCurrent(&m_mdc);
         if (swapcontext(&t_threadFiber->m_ctx, &m_ctx))
         {
             SAKE_ASSERT2(false, "swapcontext failed");
@@ -110,6 +112,7 @@ namespace sake
     void Fiber::swapOut() // 把当前协程放到后台，当前协程转主协程
     {
         SetThis(t_threadFiber.get());
+        LogMdc::SetCurrent(nullptr);
         if (swapcontext(&m_ctx, &t_threadFiber->m_ctx))
         {
             SAKE_ASSERT2(false, "swapcontext failed");
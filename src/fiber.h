@@ -31,9 +31,10 @@ namespace sake
         // 重置协程函数，并重置状态
         // INIT , TERM
         void reset(std::function<void()> cb);
-        void swapIn();  // 切换到当前协程执行
-        void swapOut(); // 把当前协程放到后台
+        void swapIn();  // 切换到当前协程执行，同时切换到协程的日志诊断上下文
+        void swapOut(); // 把当前协程放到后台，回到线程的日志诊断上下文
         uint64_t getId() const { return m_id; }
+        LogMdc &getMdc() { return m_mdc; }
 
     public:
         static void SetThis(Fiber *f); // 设置当前协程
@@ -54,5 +55,8 @@ namespace sake
         void *m_stack = nullptr;
 
         std::function<void()> m_cb;
+
+        // 日志诊断上下文，主协程用线程的
+        LogMdc m_mdc = LogMdc();
     };
 }
@@ -1,466 +1,3928 @@
 #include "log.h"
 #include "config.h"
+#include <algorithm>
+#include <cmath>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <signal.h>
+#include <execinfo.h>
+#include <sys/syscall.h>
+#include <time.h>
 
 namespace sake
 {
-    class MessageFormatItem : public LogFormatter::FormatItem
+    // 无符号整数追加到buf，不经过iostream
+    static void AppendUInt(std::string &buf, uint64_t v)
     {
-    public:
-        MessageFormatItem(const std::string &str = "") {}
-        void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override
+        char tmp[20];
+        char *end = tmp + sizeof(tmp);
+        char *p = end;
+        do
         {
-            os << event->getContent();
-        }
-    };
+            *--p = (char)('0' + v % 10);
+            v /= 10;
+        } while (v);
+        buf.append(p, end - p);
+    }
 
-    class LevelFormatItem : public LogFormatter::FormatItem
+    static void AppendInt(std::string &buf, int64_t v)
     {
-    public:
-        LevelFormatItem(const std::string &str = "") {}
-        void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override
+        if (v < 0)
         {
-            os << LogLevel::ToString(level);
+            buf.push_back('-');
+            AppendUInt(buf, (uint64_t)0 - (uint64_t)v);
+            return;
         }
-    };
+        AppendUInt(buf, (uint64_t)v);
+    }
 
-    class ElapseFormatItem : public LogFormatter::FormatItem
+    // 浮点数用最短的能还原原值的写法，NaN/Inf在JSON里没有对应值，输出null
+    static void AppendDouble(std::string &buf, double v, bool json)
     {
-    public:
-        ElapseFormatItem(const std::string &str = "") {}
-        void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override
+        if (json && !std::isfinite(v))
         {
-            os << event->getElapse();
+            buf.append("null");
+            return;
         }
-    };
-
-    class NameFormatItem : public LogFormatter::FormatItem
-    {
-    public:
-        NameFormatItem(const std::string &str = "") {}
-        void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override
+        char tmp[32];
+        int len = snprintf(tmp, sizeof(tmp), "%.15g", v);
+        if (strtod(tmp, nullptr) != v)
         {
-            os << event->getLogger()->getName();
+            len = snprintf(tmp, sizeof(tmp), "%.17g", v);
         }
-    };
+        buf.append(tmp, len);
+    }
 
-    class ThreadIdFormatItem : public LogFormatter::FormatItem
+    // SWAR：一次判断8个字节，haszero/hasless见Bit Twiddling Hacks
+    static const uint64_t s_ones = 0x0101010101010101ULL;
+    static const uint64_t s_highs = 0x8080808080808080ULL;
+    static inline uint64_t HasZeroByte(uint64_t w) { return (w - s_ones) & ~w & s_highs; }
+    static inline uint64_t HasByteLess(uint64_t w, uint8_t n) { return (w - s_ones * n) & ~w & s_highs; }
+    static inline uint64_t HasByte(uint64_t w, uint8_t c) { return HasZeroByte(w ^ (s_ones * c)); }
+
+    // 8字节里有控制字符、引号或反斜杠
+    static inline bool JsonBlockClean(const char *p)
     {
-    public:
-        ThreadIdFormatItem(const std::string &str = "") {}
-        void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override
-        {
-            os << event->getThreadId();
-        }
-    };
+        uint64_t w;
+        memcpy(&w, p, sizeof(w));
+        return !(HasByteLess(w, 0x20) | HasByte(w, '"') | HasByte(w, '\\'));
+    }
 
-    class FiberIdFormatItem : public LogFormatter::FormatItem
+    // JSON字符串转义，不含两侧引号；干净的块整段拷贝，只有需要转义的字节逐个处理
+    static void AppendJsonEscaped(std::string &buf, const char *data, size_t len)
     {
-    public:
-        FiberIdFormatItem(const std::string &str = "") {}
-        void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override
+        static const char s_hex[] = "0123456789abcdef";
+        size_t begin = 0;
+        size_t i = 0;
+        while (i < len)
         {
-            os << event->getFiberId();
+            if (i + 8 <= len && JsonBlockClean(data + i))
+            {
+                i += 8;
+                continue;
+            }
+            unsigned char c = data[i];
+            if (c >= 0x20 && c != '"' && c != '\\')
+            {
+                ++i;
+                continue;
+            }
+            buf.append(data + begin, i - begin);
+            buf.push_back('\\');
+            switch (c)
+            {
+            case '"':
+                buf.push_back('"');
+                break;
+            case '\\':
+                buf.push_back('\\');
+                break;
+            case '\n':
+                buf.push_back('n');
+                break;
+            case '\r':
+                buf.push_back('r');
+                break;
+            case '\t':
+                buf.push_back('t');
+                break;
+            default:
+                buf.append("u00");
+                buf.push_back(s_hex[c >> 4]);
+                buf.push_back(s_hex[c & 0xf]);
+                break;
+            }
+            begin = ++i;
         }
-    };
+        buf.append(data + begin, len - begin);
+    }
 
-    class ThreadNameFormatItem : public LogFormatter::FormatItem
+    // logfmt的值含空白、控制字符、引号、等号或反斜杠时要加引号
+    static bool LogfmtNeedsQuote(const char *data, size_t len)
     {
-    public:
-        ThreadNameFormatItem(const std::string &str = "") {}
-        void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override
+        if (len == 0)
         {
-            os << event->getThreadName();
+            return true;
         }
-    };
-    class DateTimeFormatItem : public LogFormatter::FormatItem
-    {
-    public:
-        DateTimeFormatItem(const std::string &format = "%Y-%m-%d %H-%M-%S") : m_format(format)
+        size_t i = 0;
+        for (; i + 8 <= len; i += 8)
         {
-            if (m_format.empty())
+            uint64_t w;
+            memcpy(&w, data + i, sizeof(w));
+            if (HasByteLess(w, 0x21) | HasByte(w, '"') | HasByte(w, '=') | HasByte(w, '\\'))
             {
-                m_format = "%Y-%m-%d %H:%M%S";
+                return true;
             }
         }
-
-        void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override
+        for (; i < len; ++i)
         {
-            struct tm tm;
-            time_t time = event->getTime();
-            localtime_r(&time, &tm);
-            char buf[64];
-            strftime(buf, sizeof(buf), m_format.c_str(), &tm);
-            os << buf;
+            unsigned char c = data[i];
+            if (c <= ' ' || c == '"' || c == '=' || c == '\\')
+            {
+                return true;
+            }
         }
+        return false;
+    }
 
-    private:
-        std::string m_format;
-    };
+    static const int s_format_buffer_depth = 4;
+    static thread_local std::string t_format_buffers[s_format_buffer_depth];
+    static thread_local int t_format_depth = 0;
 
-    class FileNameFormatItem : public LogFormatter::FormatItem
+    // 格式化用的线程局部缓冲，复用容量，稳态下不再分配内存
+    // 按嵌套深度取用，appender内部再打日志不会覆盖外层正在使用的内容
+    class FormatBuffer
     {
     public:
-        FileNameFormatItem(const std::string &str = "") {}
-        void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override
+        FormatBuffer()
+            : m_buf(t_format_depth < s_format_buffer_depth ? t_format_buffers[t_format_depth] : m_local)
         {
-            os << event->getFile();
+            ++t_format_depth;
+            m_buf.clear();
         }
-    };
 
-    class LineFormatItem : public LogFormatter::FormatItem
-    {
-    public:
-        LineFormatItem(const std::string &str = "") {}
-        void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override
+        ~FormatBuffer()
         {
-            os << event->getLine();
+            --t_format_depth;
         }
+
+        std::string &get() { return m_buf; }
+
+    private:
+        std::string m_local;
+        std::string &m_buf;
     };
 
-    class NewLineFormatItem : public LogFormatter::FormatItem
+    // 组装二进制日志块：u32 magic, u8 type, u32 length, payload
+    static std::string MakeChunk(uint8_t type, const std::string &payload)
     {
-    public:
-        NewLineFormatItem(const std::string &str = "") {}
-        void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override
-        {
-            os << std::endl;
-        }
-    };
+        std::string chunk;
+        uint32_t magic = BinaryLogAppender::MAGIC;
+        uint32_t len = payload.size();
+        chunk.append((const char *)&magic, sizeof(magic));
+        chunk.push_back((char)type);
+        chunk.append((const char *)&len, sizeof(len));
+        chunk.append(payload);
+        return chunk;
+    }
 
-    class StringFormatItem : public LogFormatter::FormatItem
+    // 二进制日志的调用点和日志器登记表，新定义同步写入所有BinaryLogAppender
+    class BinaryLogRegistry
     {
     public:
-        StringFormatItem(const std::string &str) : m_string(str)
+        uint32_t addSite(const LogSite *site, LogLevel::Level level, const char *fmt)
         {
+            std::string payload;
+            const char *file = site->file;
+            int32_t line = site->line;
+            uint16_t file_len = std::min(strlen(file), (size_t)UINT16_MAX);
+            uint32_t fmt_len = strlen(fmt);
+            uint16_t func_len = std::min(strlen(site->func), (size_t)UINT16_MAX);
+            MutexType::Lock lock(m_mutex);
+            uint32_t id = ++m_sites;
+            payload.append((const char *)&id, sizeof(id));
+            payload.push_back((char)level);
+            payload.append((const char *)&line, sizeof(line));
+            payload.append((const char *)&file_len, sizeof(file_len));
+            payload.append(file, file_len);
+            payload.append((const char *)&fmt_len, sizeof(fmt_len));
+            payload.append(fmt, fmt_len);
+            payload.append((const char *)&func_len, sizeof(func_len));
+            payload.append(site->func, func_len);
+            addDefineNoLock(MakeChunk(BinaryLogAppender::CHUNK_SITE, payload));
+            return id;
         }
-        void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override
+
+        // 日志器第一次写二进制记录时登记，id由多个线程同时登记时只分配一次
+        uint32_t addLogger(const std::string &name, std::atomic<uint32_t> &id)
         {
-            os << m_string;
+            std::string payload;
+            uint16_t len = std::min(name.size(), (size_t)UINT16_MAX);
+            MutexType::Lock lock(m_mutex);
+            uint32_t value = id.load(std::memory_order_relaxed);
+            if (value)
+            {
+                return value;
+            }
+            value = ++m_loggers;
+            payload.append((const char *)&value, sizeof(value));
+            payload.append((const char *)&len, sizeof(len));
+            payload.append(name, 0, len);
+            // 定义先于使用它的记录写入
+            addDefineNoLock(MakeChunk(BinaryLogAppender::CHUNK_LOGGER, payload));
+            id.store(value, std::memory_order_release);
+            return value;
         }
 
-    private:
-        std::string m_string;
-    };
-
-    class TabFormatItem : public LogFormatter::FormatItem
-    {
-    public:
-        TabFormatItem(const std::string &str = "")
+        // 新文件先补齐已有的全部定义
+        void addSink(BinaryLogAppender *sink)
         {
+            MutexType::Lock lock(m_mutex);
+            for (auto &i : m_defines)
+            {
+                sink->writeChunk(i);
+            }
+            m_sinks.push_back(sink);
         }
-        void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override
+
+        void delSink(BinaryLogAppender *sink)
         {
-            os << "\t";
+            MutexType::Lock lock(m_mutex);
+            m_sinks.erase(std::remove(m_sinks.begin(), m_sinks.end(), sink), m_sinks.end());
         }
 
     private:
-        std::string m_string;
-    };
-
-    class FiberFormatItem : public LogFormatter::FormatItem
-    {
-    public:
-        FiberFormatItem(const std::string &str = "") {}
-        void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override
+        void addDefineNoLock(const std::string &chunk)
         {
-            os << event->getFiberId();
+            m_defines.push_back(chunk);
+            for (auto &i : m_sinks)
+            {
+                i->writeChunk(chunk);
+            }
         }
+
+    private:
+        typedef Mutex MutexType;
+        MutexType m_mutex;
+        std::vector<std::string> m_defines;
+        std::vector<BinaryLogAppender *> m_sinks;
+        uint32_t m_sites = 0;
+        uint32_t m_loggers = 0;
     };
 
-    Logger::Logger(const std::string name) : m_name(name), m_level(LogLevel::DEBUG)
+    // 不析构，静态对象中的日志器和appender在退出时仍可能用到
+    static BinaryLogRegistry &GetBinaryLogRegistry()
     {
-        m_formatter.reset(new LogFormatter("%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n"));
+        static BinaryLogRegistry *s_registry = new BinaryLogRegistry;
+        return *s_registry;
     }
 
-    LogEvent::LogEvent(std::shared_ptr<Logger> logger, LogLevel::Level level, const char *file, int32_t line, uint64_t elapse, uint32_t thread_id, uint32_t fiber_id, uint64_t time, const std::string &thread_name)
-        : m_file(file), m_line(line), m_elapse(elapse), m_threadId(thread_id), m_fiberId(fiber_id), m_time(time), m_threadName(thread_name), m_logger(logger), m_level(level)
+    LogFormatSite::LogFormatSite(const LogSite *site, LogLevel::Level level, const char *fmt)
+        : id(GetBinaryLogRegistry().addSite(site, level, fmt)), fmt(fmt)
     {
     }
 
-    const char *LogLevel::ToString(LogLevel::Level level)
-    {
-        switch (level)
-        {
-#define XX(name)         \
-    case LogLevel::name: \
-        return #name;    \
-        break;
-
-            XX(DEBUG);
-            XX(INFO);
-            XX(WARN);
-            XX(ERROR);
-            XX(FATAL);
-#undef XX
+    // 线程局部缓冲按属主编号挂在线程上，属主销毁后由下次登记顺带清理
+    static std::atomic<uint64_t> s_thread_buffer_owner{0};
+    static thread_local std::vector<std::pair<uint64_t, std::shared_ptr<void>>> t_thread_buffers;
 
-        default:
-            return "UNKNOW";
-        }
-        return "UNKNOW";
-    }
-    LogLevel::Level LogLevel::FromString(const std::string &str)
+    static uint64_t NextThreadBufferOwner()
     {
-#define XX(level, v)            \
-    if (str == #v)              \
-    {                           \
-        return LogLevel::level; \
+        return ++s_thread_buffer_owner;
     }
-        XX(DEBUG, debug);
-        XX(INFO, info);
-        XX(WARN, warn);
-        XX(ERROR, error);
-        XX(FATAL, fatal);
 
-        XX(DEBUG, DEBUG);
-        XX(INFO, INFO);
-        XX(WARN, WARN);
-        XX(ERROR, ERROR);
-        XX(FATAL, FATAL);
-        return LogLevel::UNKOWN;
-#undef XX
-    }
-    void Logger::log(LogLevel::Level level, LogEvent::ptr event)
+    static void *FindThreadBuffer(uint64_t owner)
     {
-        if (level >= m_level)
+        for (auto &i : t_thread_buffers)
         {
-            // 获取类的智能指针
-            auto self = shared_from_this();
-            MutexType::Lock lock(m_mutex);
-            if (!m_appenders.empty())
-            {
-                for (auto &it : m_appenders)
-                {
-                    it->log(self, level, event);
-                }
-            }
-            else if (m_root)
+            if (i.first == owner)
             {
-                m_root->log(level, event);
+                return i.second.get();
             }
         }
+        return nullptr;
     }
 
-    void Logger::debug(LogEvent::ptr event)
+    static void AddThreadBuffer(uint64_t owner, const std::shared_ptr<void> &buffer)
     {
-        log(LogLevel::DEBUG, event);
+        // 属主已销毁的缓冲只剩这里一份引用
+        t_thread_buffers.erase(std::remove_if(t_thread_buffers.begin(), t_thread_buffers.end(),
+                                              [](const std::pair<uint64_t, std::shared_ptr<void>> &i)
+                                              { return i.second.use_count() == 1; }),
+                               t_thread_buffers.end());
+        t_thread_buffers.push_back(std::make_pair(owner, buffer));
     }
 
-    void Logger::info(LogEvent::ptr event)
+    // 串行化所有日志器的配置修改和继承计算，锁顺序为树锁、父节点、子节点、appender
+    static Mutex &GetLoggerTreeMutex()
     {
-        log(LogLevel::INFO, event);
+        static Mutex s_mutex;
+        return s_mutex;
     }
 
-    void Logger::warn(LogEvent::ptr event)
+    Logger::Logger(const std::string name)
+        : m_name(name), m_level(LogLevel::DEBUG), m_resolvedLevel(LogLevel::DEBUG),
+          m_effectiveLevel(LogLevel::DEBUG), m_recorderId(NextThreadBufferOwner())
     {
-        log(LogLevel::WARN, event);
+        m_formatter.reset(new LogFormatter("%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n"));
     }
 
-    void Logger::error(LogEvent::ptr event)
+    uint32_t Logger::registerId() const
     {
-        log(LogLevel::ERROR, event);
+        return GetBinaryLogRegistry().addLogger(m_name, m_id);
     }
 
-    void Logger::fatal(LogEvent::ptr event)
+    LogStreamBuf::LogStreamBuf()
     {
-        log(LogLevel::FATAL, event);
+        setp(m_inline, m_inline + sizeof(m_inline));
     }
 
-    void Logger::addAppender(LogAppender::ptr appender)
+    void LogStreamBuf::reset()
     {
-        MutexType::Lock lock(m_mutex);
-        if (!appender->getFormatter())
+        // 超大的消息不长期占着内存
+        if (m_spill.size() > 64 * 1024)
         {
-            MutexType::Lock ll(appender->m_mutex);
-            appender->m_formatter = m_formatter;
+            std::string().swap(m_spill);
+        }
+        if (m_spill.empty())
+        {
+            setp(m_inline, m_inline + sizeof(m_inline));
+        }
+        else
+        {
+            setp(&m_spill[0], &m_spill[0] + m_spill.size());
         }
-        m_appenders.push_back(appender);
     }
 
-    void Logger::delAppender(LogAppender::ptr appender)
+    void LogStreamBuf::grow(size_t need)
     {
-        MutexType::Lock lock(m_mutex);
-        for (auto it = m_appenders.begin(); it != m_appenders.end(); ++it)
+        size_t used = size();
+        size_t cap = (epptr() - pbase()) * 2;
+        while (cap < used + need)
         {
-            if (*it == appender)
-            {
-                m_appenders.erase(it);
-                break;
-            }
+            cap *= 2;
+        }
+        if (pbase() == m_inline)
+        {
+            m_spill.resize(cap);
+            memcpy(&m_spill[0], m_inline, used);
         }
+        else
+        {
+            m_spill.resize(cap);
+        }
+        setp(&m_spill[0], &m_spill[0] + m_spill.size());
+        pbump(used);
     }
 
-    void Logger::clearAppenders()
+    LogStreamBuf::int_type LogStreamBuf::overflow(int_type c)
     {
-        m_appenders.clear();
+        if (traits_type::eq_int_type(c, traits_type::eof()))
+        {
+            return traits_type::not_eof(c);
+        }
+        grow(1);
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+        return c;
     }
 
-    void Logger::setLogFormatter(LogFormatter::ptr val)
+    std::streamsize LogStreamBuf::xsputn(const char *s, std::streamsize n)
     {
-        MutexType::Lock lock(m_mutex);
-        m_formatter = val;
-        for (auto &i : m_appenders)
+        if (epptr() - pptr() < n)
         {
-            MutexType::Lock ll(i->m_mutex);
-            if (!i->m_hasFormatter)
-            {
-                i->m_formatter = m_formatter;
-            }
+            grow(n);
         }
+        memcpy(pptr(), s, n);
+        pbump(n);
+        return n;
     }
 
-    void Logger::setLogFormatter(const std::string &val)
+    LogStream::LogStream(LogEvent *event) : std::ostream(nullptr), m_event(event)
     {
-        sake::LogFormatter::ptr new_val(new sake::LogFormatter(val));
-        if (new_val->isError())
-        {
-            std::cout << "Logger setLogFormatter name = " << m_name
-                      << " value = " << val << " invalid formatter" << std::endl;
-            return;
-        }
-        setLogFormatter(new_val);
+        rdbuf(&m_buf);
     }
 
-    LogFormatter::ptr Logger::getLogFormatter()
+    void LogStream::reset()
     {
-        return m_formatter;
+        m_buf.reset();
+        clear();
+        flags(std::ios_base::skipws | std::ios_base::dec);
+        precision(6);
+        width(0);
+        fill(' ');
     }
 
-    std::string Logger::toYamlString()
+    // 调用点登记表和开关规则
+    struct LogSiteRegistry
     {
-        MutexType::Lock lock(m_mutex);
-        YAML::Node node;
-        node["name"] = m_name;
-        node["level"] = LogLevel::ToString(m_level);
-        if (m_level != LogLevel::UNKOWN)
-        {
-            node["level"] = LogLevel::ToString(m_level);
-        }
-        if (m_formatter)
-        {
-            node["formatter"] = m_formatter->getPattern();
-        }
-        for (auto &i : m_appenders)
+        // 不经过宏的调用点，字符串由自己持有
+        struct Interned
         {
-            node["appenders"].push_back(YAML::Load(i->toYamlString()));
-        }
+            Interned(const char *f, int32_t l)
+                : file(f), lineStr(std::to_string(l)), site(file.c_str(), l, lineStr.c_str(), "", LogLevel::UNKOWN)
+            {
+                site.state = LogSite::STATE_ON;
+            }
 
-        std::stringstream ss;
-        ss << node;
-        return ss.str();
-    }
+            std::string file;
+            std::string lineStr;
+            LogSite site;
+        };
 
-    void LogAppender::setFormater(LogFormatter::ptr formatter)
-    {
-        MutexType::Lock lock(m_mutex);
-        m_formatter = formatter;
-        if (m_formatter)
+        // 按文件内容和行号查找，查找时直接用调用方的指针，不拼字符串
+        struct InternedKey
         {
-            m_hasFormatter = true;
-        }
-        else
+            const char *file;
+            int32_t line;
+
+            bool operator==(const InternedKey &oth) const
+            {
+                return line == oth.line && strcmp(file, oth.file) == 0;
+            }
+        };
+
+        struct InternedHash
         {
-            m_hasFormatter = false;
-        }
-    }
+            size_t operator()(const InternedKey &key) const
+            {
+                size_t h = 14695981039346656037ull ^ (uint32_t)key.line;
+                for (const char *p = key.file; *p; ++p)
+                {
+                    h = (h ^ (unsigned char)*p) * 1099511628211ull;
+                }
+                return h;
+            }
+        };
 
-    LogFormatter::ptr LogAppender::getFormatter()
+        Mutex mutex;
+        std::vector<LogSite *> sites;
+        // 文件、行号(0表示整个文件)、开关，按设置顺序匹配，后设置的优先
+        std::vector<std::tuple<std::string, int32_t, bool>> rules;
+        // 键里的file指向Interned自己持有的字符串
+        std::unordered_map<InternedKey, std::unique_ptr<Interned>, InternedHash> interned;
+    };
+
+    // 登记的不同文件和行号个数上限，超出后不再登记，事件使用空调用点
+    static const size_t s_interned_max = 64 * 1024;
+    // 线程局部的直接映射缓存，命中时不加锁也不分配
+    static const size_t s_interned_cache_size = 64;
+
+    struct LogSiteCacheEntry
     {
-        MutexType::Lock lock(m_mutex);
-        return m_formatter;
-    }
+        const char *file;
+        int32_t line;
+        const LogSite *site;
+    };
 
-    FileLogAppender::FileLogAppender(const std::string &filename) : m_filename(filename)
+    // 平凡类型，零初始化即为空
+    static thread_local LogSiteCacheEntry t_site_cache[s_interned_cache_size];
+
+    // 调用点可能在静态初始化期间执行，登记表按需构造且不析构
+    static LogSiteRegistry &GetLogSiteRegistry()
     {
-        reopen();
+        static LogSiteRegistry *s_registry = new LogSiteRegistry;
+        return *s_registry;
     }
 
-    bool FileLogAppender::reopen()
+    // file是site->file的结尾，且在路径分隔处
+    static bool LogSiteMatch(const LogSite *site, const std::string &file, int32_t line)
     {
-        MutexType::Lock lock(m_mutex);
-        if (m_filestream)
+        if (line && site->line != line)
+        {
+            return false;
+        }
+        size_t len = strlen(site->file);
+        if (len < file.size() || file.compare(0, file.size(), site->file + len - file.size()) != 0)
         {
-            m_filestream.close();
+            return false;
         }
-        m_filestream.open(m_filename, std::ios::app);
-        return !m_filestream;
+        return len == file.size() || site->file[len - file.size() - 1] == '/';
     }
 
-    std::string FileLogAppender::toYamlString()
+    bool LogSite::Register(LogSite *site)
     {
-        YAML::Node node;
-        node["type"] = "FileLogAppender";
-        node["file"] = m_filename;
-        if (m_level != LogLevel::UNKOWN)
+        LogSiteRegistry &registry = GetLogSiteRegistry();
+        Mutex::Lock lock(registry.mutex);
+        // 其他线程可能已经登记过
+        int8_t s = site->state.load(std::memory_order_relaxed);
+        if (s != STATE_NEW)
         {
-            node["level"] = LogLevel::ToString(m_level);
+            return s > 0;
         }
-        if (m_hasFormatter && m_formatter)
+        bool on = true;
+        for (auto &i : registry.rules)
         {
-            node["formatter"] = m_formatter->getPattern();
+            if (LogSiteMatch(site, std::get<0>(i), std::get<1>(i)))
+            {
+                on = std::get<2>(i);
+            }
         }
-        std::stringstream ss;
-        ss << node;
-        return ss.str();
+        registry.sites.push_back(site);
+        site->state.store(on ? STATE_ON : STATE_OFF, std::memory_order_relaxed);
+        return on;
     }
 
-    void FileLogAppender::log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event)
+    size_t LogSite::SetEnabled(const std::string &spec, bool on)
     {
-        if (level >= m_level)
+        std::string file = spec;
+        int32_t line = 0;
+        size_t pos = spec.rfind(':');
+        if (pos != std::string::npos && pos + 1 < spec.size() && spec.find_first_not_of("0123456789", pos + 1) == std::string::npos)
         {
-            uint64_t now = time(0);
-            if (now != m_lastTime)
-            {
-                reopen();
-                m_lastTime = now;
-            }
-            MutexType::Lock lock(m_mutex);
-            if (!(m_filestream << m_formatter->format(logger, level, event)))
+            file = spec.substr(0, pos);
+            line = atoi(spec.c_str() + pos + 1);
+        }
+        LogSiteRegistry &registry = GetLogSiteRegistry();
+        Mutex::Lock lock(registry.mutex);
+        registry.rules.push_back(std::make_tuple(file, line, on));
+        size_t count = 0;
+        for (auto &i : registry.sites)
+        {
+            if (LogSiteMatch(i, file, line))
             {
-                std::cout << "FileLogAppender log error: " << m_filename << std::endl;
+                i->state.store(on ? STATE_ON : STATE_OFF, std::memory_order_relaxed);
+                ++count;
             }
         }
+        return count;
     }
 
-    void StdoutLogAppender::log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event)
+    std::vector<const LogSite *> LogSite::GetSites()
     {
-        if (level >= m_level)
-        {
-            MutexType::Lock lock(m_mutex);
-            std::cout << m_formatter->format(logger, level, event);
-        }
+        LogSiteRegistry &registry = GetLogSiteRegistry();
+        Mutex::Lock lock(registry.mutex);
+        return std::vector<const LogSite *>(registry.sites.begin(), registry.sites.end());
     }
 
-    std::string StdoutLogAppender::toYamlString()
+    const LogSite *LogSite::Intern(const char *file, int32_t line)
     {
-        MutexType::Lock lock(m_mutex);
-        YAML::Node node;
-        node["type"] = "StdoutLogAppender";
-        if (m_level != LogLevel::UNKOWN)
+        // 同一个指针可能先后装着不同的文件名(如解码工具里的临时字符串)，命中时仍比较内容
+        LogSiteCacheEntry &entry = t_site_cache[(((uintptr_t)file >> 3) ^ ((uint32_t)line * 0x9e3779b1u)) % s_interned_cache_size];
+        if (entry.file == file && entry.line == line && strcmp(entry.site->file, file) == 0)
         {
-            node["level"] = LogLevel::ToString(m_level);
+            return entry.site;
         }
-        if (m_hasFormatter && m_formatter)
+        const LogSite *site = Unknown();
         {
-            node["formatter"] = m_formatter->getPattern();
-        }
-        std::stringstream ss;
-        ss << node;
+            LogSiteRegistry &registry = GetLogSiteRegistry();
+            Mutex::Lock lock(registry.mutex);
+            LogSiteRegistry::InternedKey key = {file, line};
+            auto it = registry.interned.find(key);
+            if (it != registry.interned.end())
+            {
+                site = &it->second->site;
+            }
+            else if (registry.interned.size() < s_interned_max)
+            {
+                std::unique_ptr<LogSiteRegistry::Interned> interned(new LogSiteRegistry::Interned(file, line));
+                site = &interned->site;
+                key.file = site->file;
+                registry.interned.emplace(key, std::move(interned));
+            }
+            else
+            {
+                // 超出上限，不登记也不缓存
+                return site;
+            }
+        }
+        entry.file = file;
+        entry.line = line;
+        entry.site = site;
+        return site;
+    }
+
+    const LogSite *LogSite::Unknown()
+    {
+        static const LogSite s_unknown("", 0, "0", "", LogLevel::UNKOWN);
+        return &s_unknown;
+    }
+
+    static thread_local LogMdc *t_mdc = nullptr;
+    // 平凡类型，零初始化即为空，不需要动态初始化
+    static thread_local LogMdc t_thread_mdc;
+
+    LogMdc *LogMdc::Current()
+    {
+        return t_mdc ? t_mdc : &t_thread_mdc;
+    }
+
+    void LogMdc::SetCurrent(LogMdc *mdc)
+    {
+        t_mdc = mdc;
+    }
+
+    bool LogMdc::push(const char *key, size_t key_len, const char *value, size_t value_len)
+    {
+        if (m_size >= MAX_ENTRIES)
+        {
+            return false;
+        }
+        Entry &entry = m_entries[m_size++];
+        entry.keyLen = key_len < MAX_KEY ? key_len : (size_t)MAX_KEY;
+        entry.valueLen = value_len < MAX_VALUE ? value_len : (size_t)MAX_VALUE;
+        memcpy(entry.key, key, entry.keyLen);
+        memcpy(entry.value, value, entry.valueLen);
+        return true;
+    }
+
+    const LogMdc::Entry *LogMdc::find(const char *key, size_t len) const
+    {
+        for (size_t i = m_size; i > 0; --i)
+        {
+            const Entry &entry = m_entries[i - 1];
+            if (entry.keyLen == len && memcmp(entry.key, key, len) == 0)
+            {
+                return &entry;
+            }
+        }
+        return nullptr;
+    }
+
+    void LogMdc::assign(const LogMdc &oth)
+    {
+        m_size = oth.m_size;
+        memcpy(m_entries, oth.m_entries, m_size * sizeof(Entry));
+    }
+
+    const LogMdc &LogMdc::Empty()
+    {
+        static const LogMdc s_empty = LogMdc();
+        return s_empty;
+    }
+
+    LogEvent::LogEvent()
+    {
+    }
+
+    LogEvent::LogEvent(std::shared_ptr<Logger> logger, LogLevel::Level level, const char *file, int32_t line, uint64_t elapse, uint32_t thread_id, uint32_t fiber_id, uint64_t time, const std::string &thread_name)
+        : m_site(LogSite::Intern(file, line)), m_elapse(elapse), m_threadId(thread_id), m_fiberId(fiber_id), m_time(time * 1000000), m_threadName(thread_name), m_logger(logger), m_level(level)
+    {
+    }
+
+    void LogEvent::reset(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogSite *site, uint64_t elapse, uint32_t thread_id, uint32_t fiber_id, uint64_t time_us, const std::string &thread_name)
+    {
+        m_site = site;
+        m_elapse = elapse;
+        m_threadId = thread_id;
+        m_fiberId = fiber_id;
+        m_time = time_us;
+        // assign复用已有容量
+        m_threadName.assign(thread_name);
+        if (m_logger != logger)
+        {
+            m_logger = logger;
+        }
+        m_level = level;
+        m_ss.reset();
+        m_fieldCount = 0;
+        m_fieldData.clear();
+        setMdc(*LogMdc::Current());
+    }
+
+    void LogEvent::assign(const LogEvent &oth)
+    {
+        reset(oth.m_logger, oth.m_level, oth.m_site, oth.m_elapse, oth.m_threadId, oth.m_fiberId, oth.m_time, oth.m_threadName);
+        m_ss.write(oth.getContentData(), oth.getContentSize());
+        if (oth.m_fieldCount)
+        {
+            if (!m_fields)
+            {
+                m_fields.reset(new Field[MAX_FIELDS]);
+            }
+            std::copy(oth.m_fields.get(), oth.m_fields.get() + oth.m_fieldCount, m_fields.get());
+        }
+        m_fieldCount = oth.m_fieldCount;
+        m_fieldData.assign(oth.m_fieldData);
+        setMdc(oth.getMdc());
+    }
+
+    void LogEvent::setMdc(const LogMdc &mdc)
+    {
+        if (!m_mdc)
+        {
+            if (!mdc.size())
+            {
+                return;
+            }
+            m_mdc.reset(new LogMdc());
+        }
+        m_mdc->assign(mdc);
+    }
+
+    LogEvent::Field *LogEvent::newField(const char *key)
+    {
+        if (m_fieldCount >= MAX_FIELDS)
+        {
+            return nullptr;
+        }
+        if (!m_fields)
+        {
+            m_fields.reset(new Field[MAX_FIELDS]);
+        }
+        Field *field = &m_fields[m_fieldCount++];
+        size_t len = std::min(strlen(key), (size_t)UINT16_MAX);
+        field->keyOffset = m_fieldData.size();
+        field->keyLen = len;
+        m_fieldData.append(key, len);
+        return field;
+    }
+
+    void LogEvent::addField(const char *key, bool v)
+    {
+        Field *field = newField(key);
+        if (field)
+        {
+            field->type = FIELD_BOOL;
+            field->u = v;
+        }
+    }
+
+    void LogEvent::addField(const char *key, double v)
+    {
+        Field *field = newField(key);
+        if (field)
+        {
+            field->type = FIELD_DOUBLE;
+            field->d = v;
+        }
+    }
+
+    void LogEvent::addField(const char *key, const char *v, size_t len)
+    {
+        Field *field = newField(key);
+        if (field)
+        {
+            field->type = FIELD_STRING;
+            field->s.offset = m_fieldData.size();
+            field->s.len = len;
+            m_fieldData.append(v, len);
+        }
+    }
+
+    // 每次最多探测的槽位数，找不到空闲事件时扩容
+    static const size_t s_event_pool_probes = 8;
+    // 单线程池上限，异步积压超过后退化为直接分配
+    static const size_t s_event_pool_max = 1024;
+
+    struct LogEventPoolData
+    {
+        std::vector<LogEvent::ptr> events;
+        size_t cursor = 0;
+    };
+
+    LogEvent::ptr LogEventPool::Acquire()
+    {
+        static thread_local LogEventPoolData t_pool;
+        std::vector<LogEvent::ptr> &events = t_pool.events;
+        size_t probes = std::min(events.size(), s_event_pool_probes);
+        for (size_t i = 0; i < probes; ++i)
+        {
+            // 轮询的顺序和异步队列释放的顺序一致，通常第一个就可用
+            LogEvent::ptr &e = events[t_pool.cursor];
+            t_pool.cursor = (t_pool.cursor + 1) % events.size();
+            if (e.use_count() == 1)
+            {
+                // use_count是relaxed读，配合acquire栅栏看到其他线程释放前的写入
+                std::atomic_thread_fence(std::memory_order_acquire);
+                return e;
+            }
+        }
+        LogEvent::ptr e = std::make_shared<LogEvent>();
+        if (events.size() < s_event_pool_max)
+        {
+            events.push_back(e);
+        }
+        return e;
+    }
+
+    const char *LogLevel::ToString(LogLevel::Level level)
+    {
+        switch (level)
+        {
+#define XX(name)         \
+    case LogLevel::name: \
+        return #name;    \
+        break;
+
+            XX(DEBUG);
+            XX(INFO);
+            XX(WARN);
+            XX(ERROR);
+            XX(FATAL);
+#undef XX
+
+        default:
+            return "UNKNOW";
+        }
+        return "UNKNOW";
+    }
+    LogLevel::Level LogLevel::FromString(const std::string &str)
+    {
+#define XX(level, v)            \
+    if (str == #v)              \
+    {                           \
+        return LogLevel::level; \
+    }
+        XX(DEBUG, debug);
+        XX(INFO, info);
+        XX(WARN, warn);
+        XX(ERROR, error);
+        XX(FATAL, fatal);
+
+        XX(DEBUG, DEBUG);
+        XX(INFO, INFO);
+        XX(WARN, WARN);
+        XX(ERROR, ERROR);
+        XX(FATAL, FATAL);
+        return LogLevel::UNKOWN;
+#undef XX
+    }
+    void Logger::log(LogLevel::Level level, const LogEvent::ptr &event)
+    {
+        if (level < m_emitLevel.load(std::memory_order_relaxed))
+        {
+            // 只读一次，配置重新加载可能同时把大小改成0
+            size_t size = m_recordSize.load(std::memory_order_relaxed);
+            if (size && level >= m_recordLevel.load(std::memory_order_relaxed))
+            {
+                record(event, size);
+            }
+            return;
+        }
+        if (m_dedupWindow.load(std::memory_order_relaxed))
+        {
+            SnapshotPtr<LogDedup::ptr>::ReadGuard dedup(m_dedup);
+            if (*dedup && !(*dedup)->check(level, *event))
+            {
+                return;
+            }
+        }
+        if (m_recordSize.load(std::memory_order_relaxed) && level >= m_dumpLevel.load(std::memory_order_relaxed))
+        {
+            dumpRecorder();
+        }
+        dispatch(level, event);
+    }
+
+    void Logger::dispatch(LogLevel::Level level, const LogEvent::ptr &event)
+    {
+        // 读取当前快照，不加锁；appender输出期间写者只会等待，不会阻塞其他读者
+        // 继承来的快照已经是祖先的appender集合，不再转交祖先
+        SnapshotPtr<AppenderSet>::ReadGuard set(m_appenders);
+        for (auto &i : set->direct)
+        {
+            i->log(this, level, event);
+        }
+        for (auto &g : set->groups)
+        {
+            // 组内第一个接受该级别的appender触发格式化，其余复用结果
+            FormatBuffer buf;
+            bool formatted = false;
+            for (auto &i : g.appenders)
+            {
+                if (level < i->getLevel())
+                {
+                    continue;
+                }
+                if (!formatted)
+                {
+                    g.formatter->format(buf.get(), level, *event);
+                    formatted = true;
+                }
+                i->append(level, event, buf.get().data(), buf.get().size());
+            }
+        }
+    }
+
+    void Logger::setRecorder(size_t size, LogLevel::Level record_level, LogLevel::Level dump_level)
+    {
+        MutexType::Lock tree(GetLoggerTreeMutex());
+        MutexType::Lock lock(m_mutex);
+        m_recordLevel.store(record_level, std::memory_order_relaxed);
+        m_dumpLevel.store(dump_level, std::memory_order_relaxed);
+        m_recordSize.store(size, std::memory_order_relaxed);
+        updateEffectiveLevelNoLock();
+    }
+
+    void Logger::record(const LogEvent::ptr &event, size_t size)
+    {
+        if (size == 0)
+        {
+            return;
+        }
+        RecorderRing *ring = (RecorderRing *)FindThreadBuffer(m_recorderId);
+        if (!ring)
+        {
+            std::shared_ptr<RecorderRing> new_ring(new RecorderRing);
+            {
+                Mutex::Lock lock(m_ringsMutex);
+                m_rings.push_back(new_ring);
+            }
+            AddThreadBuffer(m_recorderId, new_ring);
+            ring = new_ring.get();
+        }
+        SpinLock::Lock lock(ring->mutex);
+        if (ring->events.size() != size)
+        {
+            ring->events.clear();
+            ring->events.resize(size);
+            ring->next = 0;
+            ring->count = 0;
+        }
+        // 槽位里的事件可能还被异步appender持有，这时换一个新的
+        LogEvent::ptr &slot = ring->events[ring->next];
+        if (!slot || slot.use_count() > 1)
+        {
+            slot = std::make_shared<LogEvent>();
+        }
+        else
+        {
+            std::atomic_thread_fence(std::memory_order_acquire);
+        }
+        slot->assign(*event);
+        // 缓冲挂在日志器上，事件不能再反过来持有日志器
+        slot->setLogger(nullptr);
+        ring->next = (ring->next + 1) % size;
+        ring->count = std::min(ring->count + 1, size);
+    }
+
+    void Logger::TakeRing(RecorderRing &ring, std::vector<LogEvent::ptr> &events)
+    {
+        SpinLock::Lock lock(ring.mutex);
+        size_t size = ring.events.size();
+        for (size_t i = 0; i < ring.count; ++i)
+        {
+            events.push_back(ring.events[(ring.next + size - ring.count + i) % size]);
+        }
+        ring.count = 0;
+    }
+
+    void Logger::dumpRecorder(bool all_threads)
+    {
+        // 先取出再输出，输出期间不持有缓冲的锁，appender里再打日志也不会死锁
+        std::vector<LogEvent::ptr> events;
+        if (!all_threads)
+        {
+            RecorderRing *ring = (RecorderRing *)FindThreadBuffer(m_recorderId);
+            if (!ring)
+            {
+                return;
+            }
+            TakeRing(*ring, events);
+        }
+        else
+        {
+            std::vector<std::shared_ptr<RecorderRing>> rings;
+            {
+                Mutex::Lock lock(m_ringsMutex);
+                rings = m_rings;
+            }
+            for (auto &i : rings)
+            {
+                TakeRing(*i, events);
+            }
+            // 多个线程的事件按时间合并
+            std::stable_sort(events.begin(), events.end(), [](const LogEvent::ptr &a, const LogEvent::ptr &b)
+                             { return a->getTimeUs() < b->getTimeUs(); });
+            // 线程已退出的缓冲只剩这里的两份引用
+            rings.clear();
+            Mutex::Lock lock(m_ringsMutex);
+            m_rings.erase(std::remove_if(m_rings.begin(), m_rings.end(),
+                                         [](const std::shared_ptr<RecorderRing> &i)
+                                         { return i.use_count() == 1; }),
+                          m_rings.end());
+        }
+        // 缓冲里的事件不持有日志器，拷贝一份补上再输出，异步appender拿到的是拷贝
+        Logger::ptr self = shared_from_this();
+        for (auto &i : events)
+        {
+            LogEvent::ptr event = LogEventPool::Acquire();
+            event->assign(*i);
+            event->setLogger(self);
+            dispatch(event->getLevel(), event);
+        }
+    }
+
+    void Logger::setDedup(uint32_t window_ms, size_t slots)
+    {
+        MutexType::Lock lock(m_mutex);
+        LogDedup::ptr current = *m_dedup.get();
+        LogDedup::ptr dedup;
+        if (window_ms)
+        {
+            if (current && current->getWindow() == window_ms && current->getSlots() == LogDedup::RoundSlots(slots))
+            {
+                // 配置重新加载时参数没变，沿用原表
+                return;
+            }
+            // 去重表归日志器所有，回调只弱引用日志器，日志器析构时未结束的窗口不再汇报
+            std::weak_ptr<Logger> weak(shared_from_this());
+            dedup.reset(new LogDedup(window_ms, slots, [weak](LogLevel::Level level, const LogSite *site, uint64_t repeats, const char *text, size_t len)
+                                     {
+                Logger::ptr logger = weak.lock();
+                if (!logger)
+                {
+                    return;
+                }
+                LogEvent::ptr event(new LogEvent);
+                event->reset(logger, level, site, 0, util::GetThreadId(), util::GetFiberId(), util::GetCurrentUS(), Thread::GetName());
+                event->getSS() << "[repeated " << repeats << " times] ";
+                event->getSS().write(text, len);
+                logger->dispatch(level, event); }));
+        }
+        else if (!current)
+        {
+            return;
+        }
+        m_dedupWindow.store(window_ms, std::memory_order_relaxed);
+        m_dedup.publish(std::make_shared<LogDedup::ptr>(dedup));
+        lock.unlock();
+        // publish返回时已没有线程在用旧表，在锁外释放，析构时汇报未结束的窗口并从后台线程注销
+        current.reset();
+    }
+
+    void Logger::debug(const LogEvent::ptr &event)
+    {
+        log(LogLevel::DEBUG, event);
+    }
+
+    void Logger::info(const LogEvent::ptr &event)
+    {
+        log(LogLevel::INFO, event);
+    }
+
+    void Logger::warn(const LogEvent::ptr &event)
+    {
+        log(LogLevel::WARN, event);
+    }
+
+    void Logger::error(const LogEvent::ptr &event)
+    {
+        log(LogLevel::ERROR, event);
+    }
+
+    void Logger::fatal(const LogEvent::ptr &event)
+    {
+        log(LogLevel::FATAL, event);
+    }
+
+    Logger::~Logger()
+    {
+        // appender可能比日志器活得久，解除反向引用
+        for (auto &i : m_appenderList)
+        {
+            i->delOwner(this);
+        }
+        if (m_parent)
+        {
+            MutexType::Lock tree(GetLoggerTreeMutex());
+            auto &children = m_parent->m_children;
+            children.erase(std::remove(children.begin(), children.end(), this), children.end());
+        }
+    }
+
+    void Logger::setLevel(LogLevel::Level level)
+    {
+        MutexType::Lock tree(GetLoggerTreeMutex());
+        MutexType::Lock lock(m_mutex);
+        m_level.store(level, std::memory_order_relaxed);
+        updateEffectiveLevelNoLock();
+        updateChildrenNoLock();
+    }
+
+    void Logger::refreshAppenders()
+    {
+        MutexType::Lock tree(GetLoggerTreeMutex());
+        MutexType::Lock lock(m_mutex);
+        publishNoLock(m_appenderList);
+        updateChildrenNoLock();
+    }
+
+    void Logger::publishNoLock(const AppenderList &appenders)
+    {
+        m_appenderList = appenders;
+        if (appenders.empty())
+        {
+            m_appenders.publish(m_parent ? m_parent->m_appenders.get() : std::make_shared<AppenderSet>());
+            updateEffectiveLevelNoLock();
+            return;
+        }
+        std::shared_ptr<AppenderSet> set(new AppenderSet);
+        set->appenders = appenders;
+        if (!appenders.empty())
+        {
+            set->minLevel = (LogLevel::Level)INT32_MAX;
+        }
+        for (auto &i : appenders)
+        {
+            set->minLevel = std::min(set->minLevel, i->getLevel());
+            BinaryLogAppender *binary = dynamic_cast<BinaryLogAppender *>(i.get());
+            if (binary)
+            {
+                set->binary.push_back(binary);
+            }
+            if (!i->isFormatShareable())
+            {
+                set->direct.push_back(i.get());
+                continue;
+            }
+            LogFormatter::ptr formatter = i->getFormatter();
+            if (!formatter)
+            {
+                continue;
+            }
+            auto it = std::find_if(set->groups.begin(), set->groups.end(),
+                                   [&formatter](const FormatGroup &g)
+                                   { return g.formatter == formatter; });
+            if (it == set->groups.end())
+            {
+                set->groups.push_back(FormatGroup{formatter, {}});
+                it = set->groups.end() - 1;
+            }
+            it->appenders.push_back(i.get());
+        }
+        m_appenders.publish(set);
+        updateEffectiveLevelNoLock();
+    }
+
+    void Logger::updateEffectiveLevelNoLock()
+    {
+        LogLevel::Level level = getLevel();
+        if (level == LogLevel::UNKOWN && m_parent)
+        {
+            level = m_parent->m_resolvedLevel;
+        }
+        m_resolvedLevel = level;
+        SnapshotPtr<AppenderSet>::ReadGuard set(m_appenders);
+        if (!set->appenders.empty())
+        {
+            level = std::max(level, set->minLevel);
+        }
+        m_binaryOnly.store(!set->binary.empty() && set->binary.size() == set->appenders.size(), std::memory_order_relaxed);
+        m_emitLevel.store(level, std::memory_order_relaxed);
+        // 飞行记录要拿到低于输出级别的事件
+        if (m_recordSize.load(std::memory_order_relaxed))
+        {
+            level = std::min(level, m_recordLevel.load(std::memory_order_relaxed));
+        }
+        m_effectiveLevel.store(level, std::memory_order_relaxed);
+    }
+
+    void Logger::updateChildrenNoLock()
+    {
+        for (auto &i : m_children)
+        {
+            MutexType::Lock lock(i->m_mutex);
+            // 级别和appender都是自己设置的，子树不受影响
+            if (i->getLevel() != LogLevel::UNKOWN && !i->m_appenderList.empty())
+            {
+                continue;
+            }
+            if (i->m_appenderList.empty() && i->m_appenders.get() != m_appenders.get())
+            {
+                i->m_appenders.publish(m_appenders.get());
+            }
+            i->updateEffectiveLevelNoLock();
+            i->updateChildrenNoLock();
+        }
+    }
+
+    void Logger::addAppender(LogAppender::ptr appender)
+    {
+        MutexType::Lock tree(GetLoggerTreeMutex());
+        MutexType::Lock lock(m_mutex);
+        appender->setDefaultFormatter(m_formatter);
+        appender->addOwner(this);
+        AppenderList appenders(m_appenderList);
+        appenders.push_back(appender);
+        publishNoLock(appenders);
+        updateChildrenNoLock();
+    }
+
+    void Logger::delAppender(LogAppender::ptr appender)
+    {
+        MutexType::Lock tree(GetLoggerTreeMutex());
+        MutexType::Lock lock(m_mutex);
+        AppenderList appenders(m_appenderList);
+        for (auto it = appenders.begin(); it != appenders.end(); ++it)
+        {
+            if (*it == appender)
+            {
+                appenders.erase(it);
+                publishNoLock(appenders);
+                updateChildrenNoLock();
+                appender->delOwner(this);
+                break;
+            }
+        }
+    }
+
+    void Logger::clearAppenders()
+    {
+        MutexType::Lock tree(GetLoggerTreeMutex());
+        MutexType::Lock lock(m_mutex);
+        AppenderList old;
+        old.swap(m_appenderList);
+        publishNoLock(AppenderList());
+        updateChildrenNoLock();
+        for (auto &i : old)
+        {
+            i->delOwner(this);
+        }
+    }
+
+    void Logger::setAppenders(const AppenderList &appenders)
+    {
+        MutexType::Lock tree(GetLoggerTreeMutex());
+        MutexType::Lock lock(m_mutex);
+        for (auto &i : appenders)
+        {
+            i->setDefaultFormatter(m_formatter);
+            i->addOwner(this);
+        }
+        AppenderList old(m_appenderList);
+        publishNoLock(appenders);
+        updateChildrenNoLock();
+        for (auto &i : old)
+        {
+            if (std::find(appenders.begin(), appenders.end(), i) == appenders.end())
+            {
+                i->delOwner(this);
+            }
+        }
+    }
+
+    void Logger::setLogFormatter(LogFormatter::ptr val)
+    {
+        MutexType::Lock tree(GetLoggerTreeMutex());
+        MutexType::Lock lock(m_mutex);
+        m_formatter = val;
+        for (auto &i : m_appenderList)
+        {
+            i->setDefaultFormatter(m_formatter);
+        }
+        // 默认格式器变了，重新分组
+        publishNoLock(m_appenderList);
+        updateChildrenNoLock();
+    }
+
+    void Logger::setLogFormatter(const std::string &val)
+    {
+        sake::LogFormatter::ptr new_val(new sake::LogFormatter(val));
+        if (new_val->isError())
+        {
+            std::cout << "Logger setLogFormatter name = " << m_name
+                      << " value = " << val << " invalid formatter" << std::endl;
+            return;
+        }
+        setLogFormatter(new_val);
+    }
+
+    LogFormatter::ptr Logger::getLogFormatter()
+    {
+        MutexType::Lock lock(m_mutex);
+        return m_formatter;
+    }
+
+    std::string Logger::toYamlString()
+    {
+        MutexType::Lock lock(m_mutex);
+        YAML::Node node;
+        node["name"] = m_name;
+        if (getLevel() != LogLevel::UNKOWN)
+        {
+            node["level"] = LogLevel::ToString(getLevel());
+        }
+        if (m_formatter)
+        {
+            node["formatter"] = m_formatter->getPattern();
+        }
+        if (getRecorderSize())
+        {
+            node["recorder_size"] = getRecorderSize();
+            node["recorder_level"] = LogLevel::ToString(getRecorderLevel());
+        }
+        if (getDedupWindow())
+        {
+            node["dedup_window"] = getDedupWindow();
+            node["dedup_slots"] = (*m_dedup.get())->getSlots();
+        }
+        for (auto &i : m_appenderList)
+        {
+            node["appenders"].push_back(YAML::Load(i->toYamlString()));
+        }
+
+        std::stringstream ss;
+        ss << node;
+        return ss.str();
+    }
+
+    void LogAppender::log(Logger *logger, LogLevel::Level level, const LogEvent::ptr &event)
+    {
+        if (level >= getLevel())
+        {
+            LogFormatter::ptr formatter = getFormatter();
+            if (!formatter)
+            {
+                return;
+            }
+            FormatBuffer buf;
+            formatter->format(buf.get(), level, *event);
+            append(level, event, buf.get().data(), buf.get().size());
+        }
+    }
+
+    void LogAppender::setFormater(LogFormatter::ptr formatter)
+    {
+        {
+            MutexType::Lock lock(m_mutex);
+            m_formatter = formatter;
+            if (m_formatter)
+            {
+                m_hasFormatter = true;
+            }
+            else
+            {
+                m_hasFormatter = false;
+            }
+        }
+        notifyOwners();
+    }
+
+    LogFormatter::ptr LogAppender::getFormatter()
+    {
+        MutexType::Lock lock(m_mutex);
+        return m_formatter;
+    }
+
+    void LogAppender::setLevel(LogLevel::Level level)
+    {
+        m_level.store(level, std::memory_order_relaxed);
+        notifyOwners();
+    }
+
+    void LogAppender::notifyOwners()
+    {
+        std::vector<Logger *> owners;
+        {
+            MutexType::Lock lock(m_mutex);
+            owners = m_owners;
+        }
+        // 不持有appender锁回调，锁顺序固定为先logger后appender
+        for (auto &i : owners)
+        {
+            i->refreshAppenders();
+        }
+    }
+
+    void LogAppender::addOwner(Logger *logger)
+    {
+        MutexType::Lock lock(m_mutex);
+        if (std::find(m_owners.begin(), m_owners.end(), logger) == m_owners.end())
+        {
+            m_owners.push_back(logger);
+        }
+    }
+
+    void LogAppender::delOwner(Logger *logger)
+    {
+        MutexType::Lock lock(m_mutex);
+        auto it = std::find(m_owners.begin(), m_owners.end(), logger);
+        if (it != m_owners.end())
+        {
+            m_owners.erase(it);
+        }
+    }
+
+    void LogAppender::setDefaultFormatter(LogFormatter::ptr formatter)
+    {
+        MutexType::Lock lock(m_mutex);
+        if (!m_hasFormatter)
+        {
+            m_formatter = formatter;
+        }
+    }
+
+    // 写出全部数据，处理被信号中断和部分写入
+    static bool WriteAll(int fd, const struct iovec *iov, int count)
+    {
+        while (count > 0)
+        {
+            ssize_t n = writev(fd, iov, std::min(count, IOV_MAX));
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            while (count > 0 && (size_t)n >= iov->iov_len)
+            {
+                n -= iov->iov_len;
+                ++iov;
+                --count;
+            }
+            if (count > 0 && n > 0)
+            {
+                // 当前这段只写了一部分，补完后接着写后面的
+                const char *p = (const char *)iov->iov_base + n;
+                size_t left = iov->iov_len - n;
+                while (left > 0)
+                {
+                    ssize_t m = ::write(fd, p, left);
+                    if (m < 0)
+                    {
+                        if (errno == EINTR)
+                        {
+                            continue;
+                        }
+                        return false;
+                    }
+                    p += m;
+                    left -= m;
+                }
+                ++iov;
+                --count;
+            }
+        }
+        return true;
+    }
+
+    static bool WriteAll(int fd, const char *data, size_t len)
+    {
+        struct iovec iov;
+        iov.iov_base = (void *)data;
+        iov.iov_len = len;
+        return WriteAll(fd, &iov, 1);
+    }
+
+    static const uint64_t s_batch_flush_interval_us = 10 * 1000;
+
+    // 所有LogBatcher共用的后台线程，写出超过延迟上限的缓冲
+    class LogBatchFlusher
+    {
+    public:
+        void add(LogBatcher *batcher)
+        {
+            Mutex::Lock lock(m_mutex);
+            m_batchers.push_back(batcher);
+            if (!m_thread)
+            {
+                m_thread.reset(new Thread(std::bind(&LogBatchFlusher::run, this), "log_batch"));
+            }
+        }
+
+        // 返回后后台线程不会再访问batcher
+        void del(LogBatcher *batcher)
+        {
+            Mutex::Lock lock(m_mutex);
+            m_batchers.erase(std::remove(m_batchers.begin(), m_batchers.end(), batcher), m_batchers.end());
+        }
+
+        void flush(bool expired_only)
+        {
+            Mutex::Lock lock(m_mutex);
+            for (auto i : m_batchers)
+            {
+                i->flush(expired_only);
+            }
+        }
+
+    private:
+        void run()
+        {
+            while (true)
+            {
+                usleep(s_batch_flush_interval_us);
+                flush(true);
+            }
+        }
+
+    private:
+        Mutex m_mutex;
+        std::vector<LogBatcher *> m_batchers;
+        std::unique_ptr<Thread> m_thread;
+    };
+
+    static LogBatchFlusher &GetLogBatchFlusher()
+    {
+        // 不析构，后台线程一直运行到进程退出；退出时写出所有缓冲
+        static LogBatchFlusher *s_flusher = []()
+        {
+            LogBatchFlusher *flusher = new LogBatchFlusher;
+            atexit([]()
+                   { GetLogBatchFlusher().flush(false); });
+            return flusher;
+        }();
+        return *s_flusher;
+    }
+
+    LogBatcher::LogBatcher(size_t size, uint32_t latency_ms, LogLevel::Level flush_level, Writer writer)
+        : m_size(size), m_latency(latency_ms), m_flushLevel(flush_level), m_writer(writer), m_id(NextThreadBufferOwner())
+    {
+        GetLogBatchFlusher().add(this);
+    }
+
+    LogBatcher::~LogBatcher()
+    {
+        GetLogBatchFlusher().del(this);
+        flush();
+    }
+
+    LogBatcher::Buffer &LogBatcher::getBuffer()
+    {
+        void *buffer = FindThreadBuffer(m_id);
+        if (buffer)
+        {
+            return *(Buffer *)buffer;
+        }
+        std::shared_ptr<Buffer> new_buffer(new Buffer);
+        new_buffer->data.reserve(m_size);
+        {
+            Mutex::Lock lock(m_buffersMutex);
+            m_buffers.push_back(new_buffer);
+        }
+        AddThreadBuffer(m_id, new_buffer);
+        return *new_buffer;
+    }
+
+    void LogBatcher::flushNoLock(Buffer &buffer)
+    {
+        if (buffer.data.empty())
+        {
+            return;
+        }
+        struct iovec iov;
+        iov.iov_base = (void *)buffer.data.data();
+        iov.iov_len = buffer.data.size();
+        m_writer(&iov, 1);
+        buffer.data.clear();
+    }
+
+    void LogBatcher::append(LogLevel::Level level, uint64_t now, const char *data, size_t len)
+    {
+        Buffer &buffer = getBuffer();
+        Mutex::Lock lock(buffer.mutex);
+        if (buffer.data.size() + len > m_size)
+        {
+            flushNoLock(buffer);
+            // 超过缓冲大小的单条日志直接写出
+            if (len >= m_size)
+            {
+                struct iovec iov;
+                iov.iov_base = (void *)data;
+                iov.iov_len = len;
+                m_writer(&iov, 1);
+                return;
+            }
+        }
+        if (buffer.data.empty())
+        {
+            buffer.first = now;
+        }
+        buffer.data.append(data, len);
+        if (level >= m_flushLevel || buffer.data.size() >= m_size || now >= buffer.first + m_latency * 1000ull)
+        {
+            flushNoLock(buffer);
+        }
+    }
+
+    void LogBatcher::flush(bool expired_only)
+    {
+        std::vector<std::shared_ptr<Buffer>> buffers;
+        {
+            Mutex::Lock lock(m_buffersMutex);
+            buffers = m_buffers;
+        }
+        // 锁住所有要写的缓冲，拼成一次writev；持锁期间各线程无法追加，保证线程内顺序
+        uint64_t now = util::GetCurrentUS();
+        std::vector<Buffer *> locked;
+        std::vector<struct iovec> iov;
+        for (auto &i : buffers)
+        {
+            i->mutex.lock();
+            if (i->data.empty() || (expired_only && now < i->first + m_latency * 1000ull))
+            {
+                i->mutex.unlock();
+                continue;
+            }
+            locked.push_back(i.get());
+            struct iovec v;
+            v.iov_base = (void *)i->data.data();
+            v.iov_len = i->data.size();
+            iov.push_back(v);
+        }
+        if (!iov.empty())
+        {
+            m_writer(&iov[0], iov.size());
+        }
+        for (auto i : locked)
+        {
+            i->data.clear();
+            i->mutex.unlock();
+        }
+        // 线程已退出的缓冲只剩这里的两份引用，上面已经写出
+        buffers.clear();
+        Mutex::Lock lock(m_buffersMutex);
+        m_buffers.erase(std::remove_if(m_buffers.begin(), m_buffers.end(),
+                                       [](const std::shared_ptr<Buffer> &i)
+                                       { return i.use_count() == 1 && i->data.empty(); }),
+                        m_buffers.end());
+    }
+
+    void LogBatcher::flushOnCrash(int fd)
+    {
+        // 不加锁：所属线程可能正持有锁，或者就是崩溃的线程
+        for (auto &i : m_buffers)
+        {
+            if (!i->data.empty())
+            {
+                WriteAll(fd, i->data.data(), i->data.size());
+                i->data.clear();
+            }
+        }
+    }
+
+    static void AppendBatchYaml(YAML::Node &node, const LogBatcher::ptr &batcher)
+    {
+        if (batcher)
+        {
+            node["batch_size"] = batcher->getSize();
+            node["batch_latency"] = batcher->getLatency();
+            node["flush_level"] = LogLevel::ToString(batcher->getFlushLevel());
+        }
+    }
+
+    // 路径指向的已不是dev/ino对应的文件(被改名、删除)时返回true
+    static bool IsFileReplaced(const std::string &filename, dev_t dev, ino_t ino)
+    {
+        struct stat st;
+        if (stat(filename.c_str(), &st) != 0)
+        {
+            return true;
+        }
+        return st.st_dev != dev || st.st_ino != ino;
+    }
+
+    static const uint64_t s_file_watch_interval_us = 10 * 1000;
+
+    // 文件类appender共用的后台线程，切分、预分配、检查文件是否被外部改名或删除，
+    // 这些系统调用都不在写日志的线程里做
+    class LogFileWatcher
+    {
+    public:
+        typedef std::function<void(uint64_t now)> Checker;
+
+        void add(const void *owner, Checker checker)
+        {
+            Mutex::Lock lock(m_mutex);
+            m_checkers.push_back(std::make_pair(owner, checker));
+            if (!m_thread)
+            {
+                m_thread.reset(new Thread(std::bind(&LogFileWatcher::run, this), "log_file"));
+            }
+        }
+
+        // 返回后后台线程不会再访问owner
+        void del(const void *owner)
+        {
+            Mutex::Lock lock(m_mutex);
+            m_checkers.erase(std::remove_if(m_checkers.begin(), m_checkers.end(),
+                                            [owner](const std::pair<const void *, Checker> &i)
+                                            { return i.first == owner; }),
+                             m_checkers.end());
+        }
+
+    private:
+        void run()
+        {
+            while (true)
+            {
+                usleep(s_file_watch_interval_us);
+                uint64_t now = time(0);
+                Mutex::Lock lock(m_mutex);
+                for (auto &i : m_checkers)
+                {
+                    i.second(now);
+                }
+            }
+        }
+
+    private:
+        Mutex m_mutex;
+        std::vector<std::pair<const void *, Checker>> m_checkers;
+        std::unique_ptr<Thread> m_thread;
+    };
+
+    static LogFileWatcher &GetLogFileWatcher()
+    {
+        // 不析构，后台线程一直运行到进程退出
+        static LogFileWatcher *s_watcher = new LogFileWatcher;
+        return *s_watcher;
+    }
+
+    // 限流、组提交用单调时钟，不受系统时间调整影响
+    static uint64_t MonotonicNs()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+
+    LogGroupCommit::LogGroupCommit(uint32_t interval_ms, size_t batch_size, bool wait, Committer committer)
+        : m_interval(interval_ms), m_batchSize(std::max(batch_size, (size_t)1)), m_wait(wait), m_committer(committer)
+    {
+        m_thread.reset(new Thread(std::bind(&LogGroupCommit::run, this), "log_commit"));
+    }
+
+    LogGroupCommit::~LogGroupCommit()
+    {
+        {
+            Mutex::Lock lock(m_mutex);
+            m_stopping = true;
+        }
+        m_wake.notify();
+        m_thread->join();
+    }
+
+    LogGroupCommit::Batch::ptr LogGroupCommit::waitBatchNoLock()
+    {
+        if (!m_batch)
+        {
+            m_batch.reset(new Batch);
+        }
+        ++m_batch->waiters;
+        return m_batch;
+    }
+
+    bool LogGroupCommit::append(const char *data, size_t len)
+    {
+        Mutex::Lock lock(m_mutex);
+        // 只在批次开始和攒够时唤醒后台线程
+        bool notify = m_pending.empty() || (m_pending.size() < m_batchSize && m_pending.size() + len >= m_batchSize);
+        if (m_pending.empty())
+        {
+            m_first = MonotonicNs() / 1000;
+        }
+        m_pending.append(data, len);
+        ++m_appended;
+        Batch::ptr batch;
+        if (m_wait)
+        {
+            batch = waitBatchNoLock();
+        }
+        lock.unlock();
+        if (notify)
+        {
+            m_wake.notify();
+        }
+        if (!batch)
+        {
+            return true;
+        }
+        batch->done.wait();
+        return batch->ok;
+    }
+
+    bool LogGroupCommit::sync()
+    {
+        Mutex::Lock lock(m_mutex);
+        if (m_committed == m_appended)
+        {
+            bool ok = !m_failedUnreported;
+            m_failedUnreported = false;
+            return ok;
+        }
+        // 正在提交的那批完成后才轮到待提交这一批(可能为空)，它完成时调用前的全部记录都已处理
+        Batch::ptr batch = waitBatchNoLock();
+        m_syncing = true;
+        lock.unlock();
+        m_wake.notify();
+        batch->done.wait();
+        lock.lock();
+        bool ok = !m_failedUnreported;
+        m_failedUnreported = false;
+        return ok;
+    }
+
+    void LogGroupCommit::run()
+    {
+        std::string data;
+        Mutex::Lock lock(m_mutex);
+        while (true)
+        {
+            if (m_pending.empty() && !m_syncing)
+            {
+                if (m_stopping)
+                {
+                    break;
+                }
+                lock.unlock();
+                m_wake.wait();
+                lock.lock();
+                continue;
+            }
+            if (m_interval && !m_stopping && !m_syncing && m_pending.size() < m_batchSize)
+            {
+                // 有人在等sync时不再攒批
+                uint64_t deadline = m_first + m_interval * 1000;
+                uint64_t now = MonotonicNs() / 1000;
+                if (now < deadline)
+                {
+                    lock.unlock();
+                    m_wake.waitFor(deadline - now);
+                    lock.lock();
+                    continue;
+                }
+            }
+            data.swap(m_pending);
+            m_pending.clear();
+            uint64_t seq = m_appended;
+            Batch::ptr batch;
+            batch.swap(m_batch);
+            m_syncing = false;
+            lock.unlock();
+
+            // 写出和落盘期间新到的记录攒成下一批
+            bool ok = data.empty() || m_committer(data);
+            data.clear();
+            ++m_commits;
+
+            lock.lock();
+            if (!ok)
+            {
+                // 这一批已丢失，等待者和之后的sync都要知道
+                m_failed += seq - m_committed;
+                m_failedUnreported = true;
+            }
+            m_committed = seq;
+            if (batch)
+            {
+                batch->ok = ok;
+                for (uint32_t i = 0; i < batch->waiters; ++i)
+                {
+                    batch->done.notify();
+                }
+            }
+        }
+    }
+
+    void LogGroupCommit::flushOnCrash(int fd)
+    {
+        if (!m_pending.empty() && WriteAll(fd, m_pending.data(), m_pending.size()))
+        {
+            fdatasync(fd);
+        }
+    }
+
+    FileLogAppender::FileLogAppender(const std::string &filename) : m_filename(filename)
+    {
+        reopen();
+        LogCrashHandler::Register(this);
+        GetLogFileWatcher().add(this, std::bind(&FileLogAppender::checkFile, this, std::placeholders::_1));
+    }
+
+    FileLogAppender::~FileLogAppender()
+    {
+        GetLogFileWatcher().del(this);
+        LogCrashHandler::Unregister(this);
+        // 先写出缓冲，writer还要用到fd
+        m_batcher.reset();
+        m_commit.reset();
+        if (m_fd >= 0)
+        {
+            close(m_fd);
+        }
+    }
+
+    bool FileLogAppender::reopen()
+    {
+        Mutex::Lock lock(m_fileMutex);
+        return reopenNoLock();
+    }
+
+    bool FileLogAppender::reopenNoLock()
+    {
+        int fd = open(m_filename.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0)
+        {
+            std::cout << "FileLogAppender open error: " << m_filename
+                      << " errno=" << errno << " errstr=" << strerror(errno) << std::endl;
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            return false;
+        }
+        m_dev = st.st_dev;
+        m_ino = st.st_ino;
+        {
+            MutexType::Lock lock(m_mutex);
+            std::swap(fd, m_fd);
+        }
+        // 换下来的fd已没有写者在用
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return true;
+    }
+
+    void FileLogAppender::setBatch(size_t size, uint32_t latency_ms, LogLevel::Level flush_level)
+    {
+        m_batcher.reset();
+        if (size)
+        {
+            m_batcher.reset(new LogBatcher(size, latency_ms, flush_level,
+                                           std::bind(&FileLogAppender::writeBatch, this,
+                                                     std::placeholders::_1, std::placeholders::_2)));
+        }
+    }
+
+    void FileLogAppender::flush()
+    {
+        if (m_batcher)
+        {
+            m_batcher->flush();
+        }
+    }
+
+    void FileLogAppender::setDurable(bool durable, uint32_t interval_ms, size_t batch_size, bool wait)
+    {
+        m_commit.reset();
+        if (durable)
+        {
+            m_batcher.reset();
+            m_commit.reset(new LogGroupCommit(interval_ms, batch_size, wait,
+                                              std::bind(&FileLogAppender::commitBatch, this, std::placeholders::_1)));
+        }
+    }
+
+    bool FileLogAppender::sync()
+    {
+        if (m_commit)
+        {
+            return m_commit->sync();
+        }
+        flush();
+        MutexType::Lock lock(m_mutex);
+        return m_fd >= 0 && fdatasync(m_fd) == 0;
+    }
+
+    void FileLogAppender::flushOnCrash()
+    {
+        if (m_batcher && m_fd >= 0)
+        {
+            m_batcher->flushOnCrash(m_fd);
+        }
+        if (m_commit && m_fd >= 0)
+        {
+            m_commit->flushOnCrash(m_fd);
+        }
+    }
+
+    std::string FileLogAppender::toYamlString()
+    {
+        YAML::Node node;
+        node["type"] = "FileLogAppender";
+        node["file"] = m_filename;
+        AppendBatchYaml(node, m_batcher);
+        if (m_commit)
+        {
+            node["durable"] = true;
+            node["commit_interval"] = m_commit->getInterval();
+            node["commit_batch"] = m_commit->getBatchSize();
+            node["durable_wait"] = m_commit->isWait();
+        }
+        if (getLevel() != LogLevel::UNKOWN)
+        {
+            node["level"] = LogLevel::ToString(getLevel());
+        }
+        if (m_hasFormatter && m_formatter)
+        {
+            node["formatter"] = m_formatter->getPattern();
+        }
+        std::stringstream ss;
+        ss << node;
+        return ss.str();
+    }
+
+    void FileLogAppender::checkFile(uint64_t now)
+    {
+        // 后台线程调用，只在秒数变化时stat一次，文件被外部改名或删除才重新打开
+        Mutex::Lock lock(m_fileMutex);
+        if (now != m_lastTime)
+        {
+            m_lastTime = now;
+            if (IsFileReplaced(m_filename, m_dev, m_ino))
+            {
+                reopenNoLock();
+            }
+        }
+    }
+
+    void FileLogAppender::writeBatch(const struct iovec *iov, int count)
+    {
+        MutexType::Lock lock(m_mutex);
+        if (m_fd < 0 || !WriteAll(m_fd, iov, count))
+        {
+            std::cout << "FileLogAppender log error: " << m_filename << std::endl;
+        }
+    }
+
+    bool FileLogAppender::commitBatch(const std::string &data)
+    {
+        MutexType::Lock lock(m_mutex);
+        if (m_fd < 0 || !WriteAll(m_fd, data.data(), data.size()))
+        {
+            std::cout << "FileLogAppender log error: " << m_filename << std::endl;
+            return false;
+        }
+        if (fdatasync(m_fd) != 0)
+        {
+            std::cout << "FileLogAppender fdatasync error: " << m_filename
+                      << " errno=" << errno << " errstr=" << strerror(errno) << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    void FileLogAppender::append(LogLevel::Level level, const LogEvent::ptr &event, const char *data, size_t len)
+    {
+        if (m_commit)
+        {
+            m_commit->append(data, len);
+            return;
+        }
+        if (m_batcher)
+        {
+            m_batcher->append(level, event->getTimeUs(), data, len);
+            return;
+        }
+        MutexType::Lock lock(m_mutex);
+        if (m_fd < 0 || !WriteAll(m_fd, data, len))
+        {
+            std::cout << "FileLogAppender log error: " << m_filename << std::endl;
+        }
+    }
+
+    RollingFileLogAppender::RollingFileLogAppender(const std::string &filename, uint64_t max_size, uint32_t interval,
+                                                   uint32_t max_files, uint64_t preallocate)
+        : m_filename(filename), m_maxSize(max_size), m_interval(interval), m_maxFiles(max_files), m_preallocate(preallocate)
+    {
+        if (m_maxFiles == 0)
+        {
+            // 全部保留，只在启动时找一次第一个空位，之后后缀递增
+            while (access((m_filename + "." + std::to_string(m_nextIndex)).c_str(), F_OK) == 0)
+            {
+                ++m_nextIndex;
+            }
+        }
+        reopen();
+        m_nextRoll = nextRollTime(time(0));
+        GetLogFileWatcher().add(this, std::bind(&RollingFileLogAppender::checkFile, this, std::placeholders::_1));
+    }
+
+    RollingFileLogAppender::~RollingFileLogAppender()
+    {
+        GetLogFileWatcher().del(this);
+        if (m_fd >= 0)
+        {
+            close(m_fd);
+        }
+    }
+
+    bool RollingFileLogAppender::reopen()
+    {
+        Mutex::Lock lock(m_fileMutex);
+        return reopenNoLock();
+    }
+
+    int RollingFileLogAppender::openNoLock(uint64_t &size)
+    {
+        int fd = open(m_filename.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0)
+        {
+            std::cout << "RollingFileLogAppender open error: " << m_filename
+                      << " errno=" << errno << " errstr=" << strerror(errno) << std::endl;
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            return -1;
+        }
+        m_dev = st.st_dev;
+        m_ino = st.st_ino;
+        size = st.st_size;
+        return fd;
+    }
+
+    bool RollingFileLogAppender::reopenNoLock()
+    {
+        uint64_t size = 0;
+        int fd = openNoLock(size);
+        if (fd < 0)
+        {
+            return false;
+        }
+        uint64_t old_size;
+        uint64_t old_allocated;
+        {
+            MutexType::Lock lock(m_mutex);
+            std::swap(fd, m_fd);
+            old_size = m_size;
+            old_allocated = m_allocated;
+            m_size = size;
+            // KEEP_SIZE预分配的块不计入st_size，从当前大小重新开始预分配
+            m_allocated = size;
+        }
+        // 换下来的fd已没有写者在用，释放尾部未用的预分配空间后关闭
+        if (fd >= 0)
+        {
+            if (old_allocated > old_size && ftruncate(fd, old_size) != 0)
+            {
+                std::cout << "RollingFileLogAppender truncate error: " << m_filename
+                          << " errno=" << errno << " errstr=" << strerror(errno) << std::endl;
+            }
+            close(fd);
+        }
+        preallocateNoLock();
+        return true;
+    }
+
+    void RollingFileLogAppender::preallocateNoLock()
+    {
+        if (m_preallocate == 0)
+        {
+            return;
+        }
+        int fd;
+        uint64_t allocated;
+        {
+            MutexType::Lock lock(m_mutex);
+            // 写到剩一半时再预分配下一段
+            if (m_fd < 0 || m_allocated == UINT64_MAX || m_size + m_preallocate / 2 <= m_allocated)
+            {
+                return;
+            }
+            fd = m_fd;
+            allocated = m_allocated;
+        }
+        // 持有m_fileMutex，fd不会被换掉；不改变文件大小，O_APPEND仍然写在真实末尾
+        bool ok = fallocate(fd, FALLOC_FL_KEEP_SIZE, allocated, m_preallocate) == 0;
+        MutexType::Lock lock(m_mutex);
+        // 不支持的文件系统本文件不再尝试，切分或重新打开时再试
+        m_allocated = ok ? allocated + m_preallocate : UINT64_MAX;
+    }
+
+    uint64_t RollingFileLogAppender::nextRollTime(uint64_t now) const
+    {
+        if (m_interval == 0)
+        {
+            return UINT64_MAX;
+        }
+        // 按本地时间对齐，按天切分时落在零点
+        time_t t = now;
+        struct tm tm;
+        localtime_r(&t, &tm);
+        int64_t local = (int64_t)now + tm.tm_gmtoff;
+        return (local / m_interval + 1) * m_interval - tm.tm_gmtoff;
+    }
+
+    bool RollingFileLogAppender::rotate()
+    {
+        Mutex::Lock lock(m_fileMutex);
+        return rotateNoLock(time(0));
+    }
+
+    bool RollingFileLogAppender::rotateNoLock(uint64_t now)
+    {
+        m_nextRoll = nextRollTime(now);
+        std::string archive;
+        if (m_maxFiles == 0)
+        {
+            archive = m_filename + "." + std::to_string(m_nextIndex++);
+        }
+        else
+        {
+            unlink((m_filename + "." + std::to_string(m_maxFiles)).c_str());
+            for (uint32_t i = m_maxFiles; i > 1; --i)
+            {
+                rename((m_filename + "." + std::to_string(i - 1)).c_str(),
+                       (m_filename + "." + std::to_string(i)).c_str());
+            }
+            archive = m_filename + ".1";
+        }
+        // 改名期间写者继续写旧fd，这部分日志随旧文件一起归档
+        rename(m_filename.c_str(), archive.c_str());
+        bool ok = reopenNoLock();
+        m_rotatePending = false;
+        return ok;
+    }
+
+    void RollingFileLogAppender::checkFile(uint64_t now)
+    {
+        Mutex::Lock lock(m_fileMutex);
+        if (m_rotatePending || now >= m_nextRoll)
+        {
+            rotateNoLock(now);
+            return;
+        }
+        if (now != m_lastCheck)
+        {
+            // logrotate之类改名后，路径上已不是当前fd对应的文件
+            m_lastCheck = now;
+            if (IsFileReplaced(m_filename, m_dev, m_ino))
+            {
+                reopenNoLock();
+                return;
+            }
+        }
+        preallocateNoLock();
+    }
+
+    void RollingFileLogAppender::append(LogLevel::Level level, const LogEvent::ptr &event, const char *data, size_t len)
+    {
+        MutexType::Lock lock(m_mutex);
+        if (m_fd < 0)
+        {
+            return;
+        }
+        while (len > 0)
+        {
+            ssize_t rt = write(m_fd, data, len);
+            if (rt < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                std::cout << "RollingFileLogAppender log error: " << m_filename
+                          << " errno=" << errno << " errstr=" << strerror(errno) << std::endl;
+                return;
+            }
+            data += rt;
+            len -= rt;
+            m_size += rt;
+        }
+        // 写满只做标记，由后台线程切分
+        if (m_maxSize && m_size >= m_maxSize && !m_rotatePending.load(std::memory_order_relaxed))
+        {
+            m_rotatePending = true;
+        }
+    }
+
+    std::string RollingFileLogAppender::toYamlString()
+    {
+        MutexType::Lock lock(m_mutex);
+        YAML::Node node;
+        node["type"] = "RollingFileLogAppender";
+        node["file"] = m_filename;
+        if (m_maxSize)
+        {
+            node["max_size"] = m_maxSize;
+        }
+        if (m_interval)
+        {
+            node["interval"] = m_interval;
+        }
+        if (m_maxFiles)
+        {
+            node["max_files"] = m_maxFiles;
+        }
+        if (m_preallocate)
+        {
+            node["preallocate"] = m_preallocate;
+        }
+        if (getLevel() != LogLevel::UNKOWN)
+        {
+            node["level"] = LogLevel::ToString(getLevel());
+        }
+        if (m_hasFormatter && m_formatter)
+        {
+            node["formatter"] = m_formatter->getPattern();
+        }
+        std::stringstream ss;
+        ss << node;
+        return ss.str();
+    }
+
+    StdoutLogAppender::StdoutLogAppender()
+    {
+        LogCrashHandler::Register(this);
+    }
+
+    StdoutLogAppender::~StdoutLogAppender()
+    {
+        LogCrashHandler::Unregister(this);
+        m_batcher.reset();
+    }
+
+    void StdoutLogAppender::setBatch(size_t size, uint32_t latency_ms, LogLevel::Level flush_level)
+    {
+        m_batcher.reset();
+        if (size)
+        {
+            m_batcher.reset(new LogBatcher(size, latency_ms, flush_level,
+                                           std::bind(&StdoutLogAppender::writeBatch, this,
+                                                     std::placeholders::_1, std::placeholders::_2)));
+        }
+    }
+
+    void StdoutLogAppender::flush()
+    {
+        if (m_batcher)
+        {
+            m_batcher->flush();
+        }
+    }
+
+    void StdoutLogAppender::flushOnCrash()
+    {
+        if (m_batcher)
+        {
+            m_batcher->flushOnCrash(STDOUT_FILENO);
+        }
+    }
+
+    void StdoutLogAppender::writeBatch(const struct iovec *iov, int count)
+    {
+        MutexType::Lock lock(m_mutex);
+        // 绕过std::cout直接写fd，先把std::cout里已有的内容写出去
+        std::cout.flush();
+        WriteAll(STDOUT_FILENO, iov, count);
+    }
+
+    void StdoutLogAppender::append(LogLevel::Level level, const LogEvent::ptr &event, const char *data, size_t len)
+    {
+        if (m_batcher)
+        {
+            m_batcher->append(level, event->getTimeUs(), data, len);
+            return;
+        }
+        MutexType::Lock lock(m_mutex);
+        // %n不再带flush，每条日志自己刷出，stdout重定向到管道或文件时abort/_exit也不丢
+        std::cout.write(data, len);
+        std::cout.flush();
+    }
+
+    std::string StdoutLogAppender::toYamlString()
+    {
+        MutexType::Lock lock(m_mutex);
+        YAML::Node node;
+        node["type"] = "StdoutLogAppender";
+        AppendBatchYaml(node, m_batcher);
+        if (getLevel() != LogLevel::UNKOWN)
+        {
+            node["level"] = LogLevel::ToString(getLevel());
+        }
+        if (m_hasFormatter && m_formatter)
+        {
+            node["formatter"] = m_formatter->getPattern();
+        }
+        std::stringstream ss;
+        ss << node;
+        return ss.str();
+    }
+
+    MmapFileLogAppender::Window::~Window()
+    {
+        if (addr)
+        {
+            munmap(addr, size);
+        }
+    }
+
+    MmapFileLogAppender::MmapFileLogAppender(const std::string &filename, uint64_t window)
+        : m_filename(filename)
+    {
+        uint64_t page = sysconf(_SC_PAGESIZE);
+        m_windowSize = (std::max(window, page) + page - 1) / page * page;
+        m_fd = open(m_filename.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (m_fd < 0)
+        {
+            std::cout << "MmapFileLogAppender open error: " << m_filename
+                      << " errno=" << errno << " errstr=" << strerror(errno) << std::endl;
+            return;
+        }
+        struct stat st;
+        fstat(m_fd, &st);
+        m_offset = st.st_size;
+        Mutex::Lock lock(m_mapMutex);
+        mapNoLock(st.st_size / page * page);
+        LogCrashHandler::Register(this);
+    }
+
+    MmapFileLogAppender::~MmapFileLogAppender()
+    {
+        LogCrashHandler::Unregister(this);
+        if (m_fd < 0)
+        {
+            return;
+        }
+        // 先解除映射，再截掉窗口尾部没写到的部分
+        m_window.publish(std::make_shared<Window>());
+        if (ftruncate(m_fd, m_offset) != 0)
+        {
+            std::cout << "MmapFileLogAppender truncate error: " << m_filename
+                      << " errno=" << errno << " errstr=" << strerror(errno) << std::endl;
+        }
+        close(m_fd);
+    }
+
+    void MmapFileLogAppender::flushOnCrash()
+    {
+        // 共享映射里的数据进程退出后仍会写回文件
+        if (m_fd >= 0 && ftruncate(m_fd, m_offset.load()) != 0)
+        {
+            // 信号处理函数里无处报告错误
+        }
+    }
+
+    bool MmapFileLogAppender::mapNoLock(uint64_t base)
+    {
+        // 映射范围必须在文件长度内，否则访问时SIGBUS；优先fallocate真正分配磁盘块
+        if (fallocate(m_fd, 0, base, m_windowSize) != 0 && ftruncate(m_fd, base + m_windowSize) != 0)
+        {
+            std::cout << "MmapFileLogAppender extend error: " << m_filename
+                      << " errno=" << errno << " errstr=" << strerror(errno) << std::endl;
+            return false;
+        }
+        void *addr = mmap(nullptr, m_windowSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, base);
+        if (addr == MAP_FAILED)
+        {
+            std::cout << "MmapFileLogAppender mmap error: " << m_filename
+                      << " errno=" << errno << " errstr=" << strerror(errno) << std::endl;
+            return false;
+        }
+        std::shared_ptr<Window> window(new Window);
+        window->addr = (char *)addr;
+        window->base = base;
+        window->size = m_windowSize;
+        // 返回时旧窗口已没有写者，随最后一个引用解除映射
+        m_window.publish(window);
+        return true;
+    }
+
+    void MmapFileLogAppender::append(LogLevel::Level level, const LogEvent::ptr &event, const char *data, size_t len)
+    {
+        uint64_t offset;
+        {
+            SnapshotPtr<Window>::ReadGuard window(m_window);
+            offset = m_offset.fetch_add(len, std::memory_order_relaxed);
+            if (offset >= window->base && offset + len <= window->base + window->size)
+            {
+                memcpy(window->addr + (offset - window->base), data, len);
+                return;
+            }
+        }
+        appendSlow(offset, data, len);
+    }
+
+    void MmapFileLogAppender::appendSlow(uint64_t offset, const char *data, size_t len)
+    {
+        if (m_fd < 0)
+        {
+            return;
+        }
+        Mutex::Lock lock(m_mapMutex);
+        // 映射和pwrite共用页缓存，窗口外的部分直接写文件
+        uint64_t pos = offset;
+        while (len > 0)
+        {
+            ssize_t rt = pwrite(m_fd, data, len, pos);
+            if (rt < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                std::cout << "MmapFileLogAppender log error: " << m_filename
+                          << " errno=" << errno << " errstr=" << strerror(errno) << std::endl;
+                break;
+            }
+            data += rt;
+            len -= rt;
+            pos += rt;
+        }
+        // 只有第一个越界的写者负责换窗口，新窗口从当前占位处所在页开始
+        std::shared_ptr<const Window> window = m_window.get();
+        uint64_t next = m_offset.load(std::memory_order_relaxed);
+        if (next >= window->base + window->size)
+        {
+            uint64_t page = sysconf(_SC_PAGESIZE);
+            mapNoLock(next / page * page);
+        }
+    }
+
+    std::string MmapFileLogAppender::toYamlString()
+    {
+        MutexType::Lock lock(m_mutex);
+        YAML::Node node;
+        node["type"] = "MmapFileLogAppender";
+        node["file"] = m_filename;
+        node["window"] = m_windowSize;
+        if (getLevel() != LogLevel::UNKOWN)
+        {
+            node["level"] = LogLevel::ToString(getLevel());
+        }
+        if (m_hasFormatter && m_formatter)
+        {
+            node["formatter"] = m_formatter->getPattern();
+        }
+        std::stringstream ss;
+        ss << node;
+        return ss.str();
+    }
+
+    std::string ShmLogAppender::ShmName(const std::string &name)
+    {
+        return !name.empty() && name[0] == '/' ? name : "/" + name;
+    }
+
+    // 读写双方约定单条记录最多占数据区的四分之一
+    static uint64_t ShmMaxRecord(uint64_t capacity)
+    {
+        return capacity / 4;
+    }
+
+    static uint64_t ShmRecordSize(uint64_t len)
+    {
+        return (sizeof(ShmLogAppender::Record) + len + 15) & ~(uint64_t)15;
+    }
+
+    ShmLogAppender::ShmLogAppender(const std::string &name, uint64_t size)
+        : m_name(name)
+    {
+        m_capacity = 4096;
+        while (m_capacity < size)
+        {
+            m_capacity <<= 1;
+        }
+        m_maxRecord = ShmMaxRecord(m_capacity);
+        std::string shm = ShmName(m_name);
+        int fd = shm_open(shm.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0)
+        {
+            std::cout << "ShmLogAppender shm_open error: " << shm
+                      << " errno=" << errno << " errstr=" << strerror(errno) << std::endl;
+            return;
+        }
+        uint64_t map_size = sizeof(RingHeader) + m_capacity;
+        struct stat st;
+        bool reuse = fstat(fd, &st) == 0 && (uint64_t)st.st_size == map_size;
+        if (!reuse && ftruncate(fd, map_size) != 0)
+        {
+            std::cout << "ShmLogAppender truncate error: " << shm
+                      << " errno=" << errno << " errstr=" << strerror(errno) << std::endl;
+            close(fd);
+            return;
+        }
+        void *addr = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (addr == MAP_FAILED)
+        {
+            std::cout << "ShmLogAppender mmap error: " << shm
+                      << " errno=" << errno << " errstr=" << strerror(errno) << std::endl;
+            return;
+        }
+        m_header = (RingHeader *)addr;
+        m_data = (char *)addr + sizeof(RingHeader);
+        // 同样大小的旧对象接着写，已附加的读者不用重来
+        if (!reuse || m_header->magic != MAGIC || m_header->version != VERSION || m_header->capacity != m_capacity)
+        {
+            m_header->magic = 0;
+            std::atomic_thread_fence(std::memory_order_release);
+            memset(m_data, 0, m_capacity);
+            m_header->version = VERSION;
+            m_header->capacity = m_capacity;
+            m_header->reserve.store(0, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            m_header->magic = MAGIC;
+        }
+    }
+
+    ShmLogAppender::~ShmLogAppender()
+    {
+        if (m_header)
+        {
+            munmap(m_header, sizeof(RingHeader) + m_capacity);
+        }
+    }
+
+    void ShmLogAppender::append(LogLevel::Level level, const LogEvent::ptr &event, const char *data, size_t len)
+    {
+        if (!m_header)
+        {
+            return;
+        }
+        len = std::min<uint64_t>(len, m_maxRecord);
+        uint64_t pos = m_header->reserve.fetch_add(ShmRecordSize(len), std::memory_order_relaxed);
+        // 占位先于内容可见，读者复制完内容后据reserve判断是否被覆盖
+        std::atomic_thread_fence(std::memory_order_release);
+        uint64_t mask = m_capacity - 1;
+        Record *rec = (Record *)(m_data + (pos & mask));
+        rec->len = len;
+        rec->check = Check(pos, len);
+        uint64_t off = (pos + sizeof(Record)) & mask;
+        size_t first = std::min<uint64_t>(len, m_capacity - off);
+        memcpy(m_data + off, data, first);
+        memcpy(m_data, data + first, len - first);
+        rec->pos.store(pos, std::memory_order_release);
+    }
+
+    std::string ShmLogAppender::toYamlString()
+    {
+        MutexType::Lock lock(m_mutex);
+        YAML::Node node;
+        node["type"] = "ShmLogAppender";
+        node["name"] = m_name;
+        node["size"] = m_capacity;
+        if (getLevel() != LogLevel::UNKOWN)
+        {
+            node["level"] = LogLevel::ToString(getLevel());
+        }
+        if (m_hasFormatter && m_formatter)
+        {
+            node["formatter"] = m_formatter->getPattern();
+        }
+        std::stringstream ss;
+        ss << node;
+        return ss.str();
+    }
+
+    ShmLogReader::~ShmLogReader()
+    {
+        if (m_addr)
+        {
+            munmap(m_addr, m_mapSize);
+        }
+    }
+
+    bool ShmLogReader::open(const std::string &name)
+    {
+        std::string shm = ShmLogAppender::ShmName(name);
+        int fd = shm_open(shm.c_str(), O_RDONLY | O_CLOEXEC, 0);
+        if (fd < 0)
+        {
+            std::cout << "ShmLogReader shm_open error: " << shm
+                      << " errno=" << errno << " errstr=" << strerror(errno) << std::endl;
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < sizeof(ShmLogAppender::RingHeader))
+        {
+            std::cout << "ShmLogReader invalid shm: " << shm << std::endl;
+            close(fd);
+            return false;
+        }
+        void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (addr == MAP_FAILED)
+        {
+            std::cout << "ShmLogReader mmap error: " << shm
+                      << " errno=" << errno << " errstr=" << strerror(errno) << std::endl;
+            return false;
+        }
+        const ShmLogAppender::RingHeader *header = (const ShmLogAppender::RingHeader *)addr;
+        if (header->magic != ShmLogAppender::MAGIC || header->version != ShmLogAppender::VERSION || sizeof(*header) + header->capacity != (uint64_t)st.st_size)
+        {
+            std::cout << "ShmLogReader invalid shm: " << shm << std::endl;
+            munmap(addr, st.st_size);
+            return false;
+        }
+        if (m_addr)
+        {
+            munmap(m_addr, m_mapSize);
+        }
+        m_addr = addr;
+        m_mapSize = st.st_size;
+        m_header = header;
+        m_data = (const char *)addr + sizeof(*header);
+        m_capacity = header->capacity;
+        m_pos = header->reserve.load(std::memory_order_acquire);
+        m_lost = 0;
+        return true;
+    }
+
+    bool ShmLogReader::readAt(uint64_t pos, std::string &line, uint64_t &next)
+    {
+        uint64_t mask = m_capacity - 1;
+        const ShmLogAppender::Record *rec = (const ShmLogAppender::Record *)(m_data + (pos & mask));
+        if (rec->pos.load(std::memory_order_acquire) != pos)
+        {
+            return false;
+        }
+        uint32_t len = rec->len;
+        if (len > ShmMaxRecord(m_capacity) || rec->check != ShmLogAppender::Check(pos, len))
+        {
+            return false;
+        }
+        uint64_t off = (pos + sizeof(*rec)) & mask;
+        size_t first = std::min<uint64_t>(len, m_capacity - off);
+        line.assign(m_data + off, first);
+        line.append(m_data, len - first);
+        // 复制期间若有写者占到这里，内容可能已被改写
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (m_header->reserve.load(std::memory_order_relaxed) > pos + m_capacity)
+        {
+            return false;
+        }
+        next = pos + ShmRecordSize(len);
+        return true;
+    }
+
+    void ShmLogReader::seekOldest(size_t lines)
+    {
+        if (!m_header)
+        {
+            return;
+        }
+        uint64_t reserve = m_header->reserve.load(std::memory_order_acquire);
+        uint64_t pos = reserve > m_capacity ? reserve - m_capacity : 0;
+        uint64_t next;
+        std::string line;
+        // 最早的记录可能已被部分覆盖，按对齐向后找第一条完整的
+        if (pos > 0)
+        {
+            while (pos < reserve && !readAt(pos, line, next))
+            {
+                pos += 16;
+            }
+        }
+        m_pos = pos;
+        if (lines)
+        {
+            std::vector<uint64_t> positions;
+            while (pos < reserve && readAt(pos, line, next))
+            {
+                positions.push_back(pos);
+                pos = next;
+            }
+            if (positions.size() > lines)
+            {
+                m_pos = positions[positions.size() - lines];
+            }
+        }
+    }
+
+    void ShmLogReader::resync()
+    {
+        if (!m_header)
+        {
+            return;
+        }
+        uint64_t reserve = m_header->reserve.load(std::memory_order_acquire);
+        if (reserve > m_pos)
+        {
+            m_lost += reserve - m_pos;
+        }
+        m_pos = reserve;
+    }
+
+    ShmLogReader::Result ShmLogReader::read(std::string &line)
+    {
+        if (!m_header)
+        {
+            return READ_EMPTY;
+        }
+        uint64_t reserve = m_header->reserve.load(std::memory_order_acquire);
+        if (reserve < m_pos)
+        {
+            // 写者重新初始化了缓冲
+            m_pos = 0;
+        }
+        if (m_pos >= reserve)
+        {
+            return READ_EMPTY;
+        }
+        uint64_t next;
+        if (readAt(m_pos, line, next))
+        {
+            m_pos = next;
+            return READ_OK;
+        }
+        if (m_header->reserve.load(std::memory_order_relaxed) <= m_pos + m_capacity)
+        {
+            return READ_BUSY;
+        }
+        // 读得太慢被写者追上，跳到仍保留的最早记录
+        uint64_t old = m_pos;
+        seekOldest();
+        m_lost += m_pos - old;
+        return read(line);
+    }
+
+    // 重连退避的上下限(毫秒)
+    static const uint32_t s_socket_min_backoff = 100;
+    static const uint32_t s_socket_max_backoff = 5000;
+    // 一次sendmmsg最多发出的报文数
+    static const int s_socket_max_mmsg = 64;
+
+    static uint64_t SteadyMs()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // syslog的severity
+    static int SyslogSeverity(LogLevel::Level level)
+    {
+        switch (level)
+        {
+        case LogLevel::DEBUG:
+            return 7;
+        case LogLevel::INFO:
+            return 6;
+        case LogLevel::WARN:
+            return 4;
+        case LogLevel::ERROR:
+            return 3;
+        case LogLevel::FATAL:
+            return 2;
+        default:
+            return 5;
+        }
+    }
+
+    SocketLogAppender::SocketLogAppender(const std::string &path, bool stream, uint64_t spool_size, bool syslog)
+        : m_path(path), m_stream(stream), m_spoolSize(spool_size), m_syslog(syslog)
+    {
+        m_thread.reset(new Thread(std::bind(&SocketLogAppender::run, this), "log_socket"));
+    }
+
+    SocketLogAppender::~SocketLogAppender()
+    {
+        m_stopping = true;
+        m_signal.notify();
+        m_thread->join();
+    }
+
+    bool SocketLogAppender::flush(uint32_t timeout_ms)
+    {
+        uint64_t deadline = SteadyMs() + timeout_ms;
+        while (m_pending.load() > 0)
+        {
+            if (SteadyMs() >= deadline)
+            {
+                return false;
+            }
+            usleep(1000);
+        }
+        return true;
+    }
+
+    void SocketLogAppender::append(LogLevel::Level level, const LogEvent::ptr &event, const char *data, size_t len)
+    {
+        char pri[8];
+        size_t pri_len = 0;
+        if (m_syslog)
+        {
+            // facility user(1)
+            pri_len = snprintf(pri, sizeof(pri), "<%d>", 8 + SyslogSeverity(level));
+        }
+        uint64_t total = pri_len + len;
+        // 并发时可能略超上限，不为此加锁
+        if (m_pending.load(std::memory_order_relaxed) + total > m_spoolSize)
+        {
+            ++m_dropped;
+            return;
+        }
+        m_pending.fetch_add(total, std::memory_order_relaxed);
+        SpinLock::Lock lock(m_spoolMutex);
+        // 缓存为空时后台线程可能在等待，只在这时唤醒
+        bool wake = m_lens.empty();
+        m_spool.append(pri, pri_len);
+        m_spool.append(data, len);
+        m_lens.push_back(total);
+        lock.unlock();
+        if (wake)
+        {
+            m_signal.notify();
+        }
+    }
+
+    void SocketLogAppender::run()
+    {
+        while (!m_stopping)
+        {
+            if (m_sendIndex == m_sendingLens.size())
+            {
+                m_sending.clear();
+                m_sendingLens.clear();
+                m_sendIndex = 0;
+                m_sendPos = 0;
+                m_sendPartial = 0;
+                SpinLock::Lock lock(m_spoolMutex);
+                m_sending.swap(m_spool);
+                m_sendingLens.swap(m_lens);
+            }
+            if (m_sendingLens.empty())
+            {
+                m_signal.wait();
+                continue;
+            }
+            if (m_fd < 0 && !connect())
+            {
+                // 等到下次重连，期间被新日志唤醒时connect直接返回，接着等
+                uint64_t now = SteadyMs();
+                m_signal.waitFor(m_retryTime > now ? (m_retryTime - now) * 1000 : 1000);
+                continue;
+            }
+            if (!(m_stream ? sendStream() : sendDgram()))
+            {
+                disconnect();
+            }
+        }
+        // 停止时不等采集端，所有缓存只尝试一次非阻塞发送，发不出去的丢弃
+        {
+            SpinLock::Lock lock(m_spoolMutex);
+            m_sending.append(m_spool);
+            m_sendingLens.insert(m_sendingLens.end(), m_lens.begin(), m_lens.end());
+            m_spool.clear();
+            m_lens.clear();
+        }
+        m_retryTime = 0;
+        if (m_sendIndex < m_sendingLens.size() && (m_fd >= 0 || connect()))
+        {
+            m_stream ? sendStream() : sendDgram();
+        }
+        m_dropped += m_sendingLens.size() - m_sendIndex;
+        disconnect();
+    }
+
+    bool SocketLogAppender::connect()
+    {
+        uint64_t now = SteadyMs();
+        if (now < m_retryTime)
+        {
+            return false;
+        }
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, m_path.c_str(), sizeof(addr.sun_path) - 1);
+        int fd = socket(AF_UNIX, (m_stream ? SOCK_STREAM : SOCK_DGRAM) | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0 || ::connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            m_backoff = m_backoff ? std::min(m_backoff * 2, s_socket_max_backoff) : s_socket_min_backoff;
+            m_retryTime = now + m_backoff;
+            return false;
+        }
+        m_fd = fd;
+        m_backoff = 0;
+        m_connected = true;
+        return true;
+    }
+
+    void SocketLogAppender::disconnect()
+    {
+        if (m_fd >= 0)
+        {
+            close(m_fd);
+            m_fd = -1;
+        }
+        m_connected = false;
+        m_sendPos -= m_sendPartial;
+        m_sendPartial = 0;
+    }
+
+    bool SocketLogAppender::sendStream()
+    {
+        while (m_sendIndex < m_sendingLens.size())
+        {
+            struct iovec iov;
+            iov.iov_base = (void *)(m_sending.data() + m_sendPos);
+            iov.iov_len = m_sending.size() - m_sendPos;
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            ssize_t rt = sendmsg(m_fd, &msg, MSG_NOSIGNAL);
+            if (rt < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    usleep(1000);
+                    return true;
+                }
+                return false;
+            }
+            // 按发出的字节数推进到对应的日志
+            m_sendPos += rt;
+            m_sendPartial += rt;
+            while (m_sendIndex < m_sendingLens.size() && m_sendPartial >= m_sendingLens[m_sendIndex])
+            {
+                m_sendPartial -= m_sendingLens[m_sendIndex];
+                m_pending.fetch_sub(m_sendingLens[m_sendIndex], std::memory_order_relaxed);
+                ++m_sendIndex;
+            }
+        }
+        return true;
+    }
+
+    bool SocketLogAppender::sendDgram()
+    {
+        struct mmsghdr msgs[s_socket_max_mmsg];
+        struct iovec iovs[s_socket_max_mmsg];
+        while (m_sendIndex < m_sendingLens.size())
+        {
+            int count = 0;
+            size_t pos = m_sendPos;
+            for (size_t i = m_sendIndex; i < m_sendingLens.size() && count < s_socket_max_mmsg; ++i, ++count)
+            {
+                iovs[count].iov_base = (void *)(m_sending.data() + pos);
+                iovs[count].iov_len = m_sendingLens[i];
+                memset(&msgs[count], 0, sizeof(msgs[count]));
+                msgs[count].msg_hdr.msg_iov = &iovs[count];
+                msgs[count].msg_hdr.msg_iovlen = 1;
+                pos += m_sendingLens[i];
+            }
+            int rt = sendmmsg(m_fd, msgs, count, MSG_NOSIGNAL);
+            if (rt < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+                {
+                    usleep(1000);
+                    return true;
+                }
+                if (errno != EMSGSIZE)
+                {
+                    return false;
+                }
+                // 超过报文上限的日志发不出去，丢弃
+                ++m_dropped;
+                rt = 1;
+            }
+            for (int i = 0; i < rt; ++i)
+            {
+                m_sendPos += m_sendingLens[m_sendIndex];
+                m_pending.fetch_sub(m_sendingLens[m_sendIndex], std::memory_order_relaxed);
+                ++m_sendIndex;
+            }
+        }
+        return true;
+    }
+
+    std::string SocketLogAppender::toYamlString()
+    {
+        MutexType::Lock lock(m_mutex);
+        YAML::Node node;
+        node["type"] = "SocketLogAppender";
+        node["path"] = m_path;
+        node["socket"] = m_stream ? "stream" : "dgram";
+        node["spool"] = m_spoolSize;
+        node["syslog"] = m_syslog;
+        if (getLevel() != LogLevel::UNKOWN)
+        {
+            node["level"] = LogLevel::ToString(getLevel());
+        }
+        if (m_hasFormatter && m_formatter)
+        {
+            node["formatter"] = m_formatter->getPattern();
+        }
+        std::stringstream ss;
+        ss << node;
+        return ss.str();
+    }
+
+    static const uint64_t s_binary_flush_interval_us = 50 * 1000;
+
+    BinaryLogAppender::BinaryLogAppender(const std::string &filename)
+        : m_filename(filename), m_id(NextThreadBufferOwner())
+    {
+        m_fd = open(m_filename.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+        if (m_fd < 0)
+        {
+            std::cout << "BinaryLogAppender open error: " << m_filename
+                      << " errno=" << errno << " errstr=" << strerror(errno) << std::endl;
+        }
+        GetBinaryLogRegistry().addSink(this);
+        m_thread.reset(new Thread(std::bind(&BinaryLogAppender::run, this), "log_binary"));
+        LogCrashHandler::Register(this);
+    }
+
+    BinaryLogAppender::~BinaryLogAppender()
+    {
+        LogCrashHandler::Unregister(this);
+        stop();
+        GetBinaryLogRegistry().delSink(this);
+        if (m_fd >= 0)
+        {
+            close(m_fd);
+        }
+    }
+
+    void BinaryLogAppender::stop()
+    {
+        if (m_stopping.exchange(true))
+        {
+            return;
+        }
+        m_thread->join();
+        flush();
+    }
+
+    void BinaryLogAppender::run()
+    {
+        while (!m_stopping)
+        {
+            usleep(s_binary_flush_interval_us);
+            flush();
+        }
+    }
+
+    void BinaryLogAppender::writeChunk(const std::string &chunk)
+    {
+        // O_APPEND下单次write整块落盘，不会和其他线程的块交错
+        if (m_fd >= 0 && ::write(m_fd, chunk.data(), chunk.size()) != (ssize_t)chunk.size())
+        {
+            std::cout << "BinaryLogAppender write error: " << m_filename
+                      << " errno=" << errno << " errstr=" << strerror(errno) << std::endl;
+        }
+    }
+
+    BinaryLogAppender::ThreadBuffer &BinaryLogAppender::getThreadBuffer()
+    {
+        void *found = FindThreadBuffer(m_id);
+        if (found)
+        {
+            return *(ThreadBuffer *)found;
+        }
+        std::shared_ptr<ThreadBuffer> buffer(new ThreadBuffer);
+        buffer->threadId = util::GetThreadId();
+        buffer->threadName = Thread::GetName();
+        buffer->data.reserve(64 * 1024 + 4096);
+        {
+            Mutex::Lock lock(m_buffersMutex);
+            m_buffers.push_back(buffer);
+        }
+        AddThreadBuffer(m_id, buffer);
+        return *buffer;
+    }
+
+    void BinaryLogAppender::flushNoLock(ThreadBuffer &buffer)
+    {
+        if (buffer.data.empty())
+        {
+            return;
+        }
+        std::string head;
+        uint16_t name_len = std::min(buffer.threadName.size(), (size_t)UINT16_MAX);
+        uint32_t magic = MAGIC;
+        uint32_t len = sizeof(buffer.threadId) + sizeof(name_len) + name_len + buffer.data.size();
+        PutValue(head, magic);
+        head.push_back((char)CHUNK_DATA);
+        PutValue(head, len);
+        PutValue(head, buffer.threadId);
+        PutValue(head, name_len);
+        head.append(buffer.threadName, 0, name_len);
+
+        struct iovec iov[2];
+        iov[0].iov_base = (void *)head.data();
+        iov[0].iov_len = head.size();
+        iov[1].iov_base = (void *)buffer.data.data();
+        iov[1].iov_len = buffer.data.size();
+        if (m_fd >= 0 && writev(m_fd, iov, 2) != (ssize_t)(head.size() + buffer.data.size()))
+        {
+            std::cout << "BinaryLogAppender write error: " << m_filename
+                      << " errno=" << errno << " errstr=" << strerror(errno) << std::endl;
+        }
+        buffer.data.clear();
+    }
+
+    void BinaryLogAppender::flushOnCrash()
+    {
+        if (m_fd < 0)
+        {
+            return;
+        }
+        // 和flushNoLock相同的块格式，块头放在栈上，不分配内存、不加锁
+        for (auto &i : m_buffers)
+        {
+            ThreadBuffer &buffer = *i;
+            if (buffer.data.empty())
+            {
+                continue;
+            }
+            char head[CHUNK_HEADER_SIZE + sizeof(uint32_t) + sizeof(uint16_t)];
+            uint16_t name_len = std::min(buffer.threadName.size(), (size_t)UINT16_MAX);
+            uint32_t magic = MAGIC;
+            uint32_t len = sizeof(buffer.threadId) + sizeof(name_len) + name_len + buffer.data.size();
+            memcpy(head, &magic, sizeof(magic));
+            head[sizeof(magic)] = (char)CHUNK_DATA;
+            memcpy(head + sizeof(magic) + 1, &len, sizeof(len));
+            memcpy(head + CHUNK_HEADER_SIZE, &buffer.threadId, sizeof(buffer.threadId));
+            memcpy(head + CHUNK_HEADER_SIZE + sizeof(buffer.threadId), &name_len, sizeof(name_len));
+
+            struct iovec iov[3];
+            iov[0].iov_base = head;
+            iov[0].iov_len = sizeof(head);
+            iov[1].iov_base = (void *)buffer.threadName.data();
+            iov[1].iov_len = name_len;
+            iov[2].iov_base = (void *)buffer.data.data();
+            iov[2].iov_len = buffer.data.size();
+            WriteAll(m_fd, iov, 3);
+            buffer.data.clear();
+        }
+    }
+
+    void BinaryLogAppender::flush()
+    {
+        LogFormatter::ptr formatter = getFormatter();
+        std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+        {
+            Mutex::Lock lock(m_buffersMutex);
+            // 格式模板变化时先写定义块，解码时对之后的数据生效
+            if (formatter && formatter != m_pattern)
+            {
+                std::string payload;
+                uint32_t len = formatter->getPattern().size();
+                PutValue(payload, len);
+                payload.append(formatter->getPattern());
+                writeChunk(MakeChunk(CHUNK_PATTERN, payload));
+                m_pattern = formatter;
+            }
+            buffers = m_buffers;
+        }
+        for (auto &i : buffers)
+        {
+            SpinLock::Lock lock(i->mutex);
+            flushNoLock(*i);
+        }
+        // 线程已退出的缓冲只剩这里的两份引用
+        buffers.clear();
+        Mutex::Lock lock(m_buffersMutex);
+        for (auto it = m_buffers.begin(); it != m_buffers.end();)
+        {
+            if (it->use_count() == 1)
+            {
+                {
+                    SpinLock::Lock buffer_lock((*it)->mutex);
+                    flushNoLock(**it);
+                }
+                it = m_buffers.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+
+    void BinaryLogAppender::log(Logger *logger, LogLevel::Level level, const LogEvent::ptr &event)
+    {
+        if (level < getLevel())
+        {
+            return;
+        }
+        ThreadBuffer &buffer = getThreadBuffer();
+        SpinLock::Lock lock(buffer.mutex);
+        std::string &buf = buffer.data;
+        uint16_t file_len = std::min(strlen(event->getFile()), (size_t)UINT16_MAX);
+        uint16_t func_len = std::min(strlen(event->getFunction()), (size_t)UINT16_MAX);
+        uint32_t msg_len = event->getContentSize();
+        buf.push_back(RECORD_TEXT);
+        buf.push_back((char)level);
+        PutValue(buf, logger->getId());
+        PutValue(buf, event->getTimeUs());
+        PutValue(buf, event->getFiberId());
+        PutValue(buf, (uint32_t)event->getElapse());
+        EncodeMdc(buf, event->getMdc());
+        PutValue(buf, event->getLine());
+        PutValue(buf, file_len);
+        Put(buf, event->getFile(), file_len);
+        PutValue(buf, func_len);
+        Put(buf, event->getFunction(), func_len);
+        PutValue(buf, msg_len);
+        Put(buf, event->getContentData(), msg_len);
+        buf.push_back((char)event->getFieldCount());
+        for (size_t i = 0; i < event->getFieldCount(); ++i)
+        {
+            const LogEvent::Field &field = event->getField(i);
+            buf.push_back((char)field.type);
+            PutValue(buf, field.keyLen);
+            Put(buf, event->getFieldKey(field), field.keyLen);
+            if (field.type == LogEvent::FIELD_STRING)
+            {
+                PutValue(buf, field.s.len);
+                Put(buf, event->getFieldString(field), field.s.len);
+            }
+            else
+            {
+                PutValue(buf, field.u);
+            }
+        }
+        if (buf.size() >= 64 * 1024)
+        {
+            flushNoLock(buffer);
+        }
+    }
+
+    void BinaryLogAppender::EncodeMdc(std::string &buf, const LogMdc &mdc)
+    {
+        buf.push_back((char)mdc.size());
+        for (size_t i = 0; i < mdc.size(); ++i)
+        {
+            const LogMdc::Entry &entry = mdc.get(i);
+            buf.push_back((char)entry.keyLen);
+            Put(buf, entry.key, entry.keyLen);
+            buf.push_back((char)entry.valueLen);
+            Put(buf, entry.value, entry.valueLen);
+        }
+    }
+
+    void BinaryLogAppender::EncodeArg(std::string &buf, const char *v)
+    {
+        if (!v)
+        {
+            v = "(null)";
+        }
+        uint32_t len = strlen(v);
+        buf.push_back(ARG_STRING);
+        PutValue(buf, len);
+        Put(buf, v, len);
+    }
+
+    std::string BinaryLogAppender::toYamlString()
+    {
+        MutexType::Lock lock(m_mutex);
+        YAML::Node node;
+        node["type"] = "BinaryLogAppender";
+        node["file"] = m_filename;
+        if (getLevel() != LogLevel::UNKOWN)
+        {
+            node["level"] = LogLevel::ToString(getLevel());
+        }
+        if (m_hasFormatter && m_formatter)
+        {
+            node["formatter"] = m_formatter->getPattern();
+        }
+        std::stringstream ss;
+        ss << node;
+        return ss.str();
+    }
+
+    const char *AsyncLogAppender::ToString(OverflowPolicy policy)
+    {
+        switch (policy)
+        {
+        case BLOCK:
+            return "block";
+        case DROP_NEWEST:
+            return "drop_newest";
+        case DROP_DEBUG_FIRST:
+            return "drop_debug_first";
+        }
+        return "block";
+    }
+
+    AsyncLogAppender::OverflowPolicy AsyncLogAppender::PolicyFromString(const std::string &str)
+    {
+        if (str == "drop_newest")
+        {
+            return DROP_NEWEST;
+        }
+        if (str == "drop_debug_first")
+        {
+            return DROP_DEBUG_FIRST;
+        }
+        return BLOCK;
+    }
+
+    AsyncLogAppender::AsyncLogAppender(size_t capacity, OverflowPolicy policy)
+        : m_policy(policy)
+    {
+        // 容量向上取整为2的幂，下标用掩码计算
+        size_t size = 2;
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+        m_mask = size - 1;
+        m_slots.reset(new Slot[size]);
+        for (size_t i = 0; i < size; ++i)
+        {
+            m_slots[i].seq.store(i, std::memory_order_relaxed);
+        }
+        m_thread.reset(new Thread(std::bind(&AsyncLogAppender::run, this), "log_async"));
+        LogCrashHandler::Register(this, true);
+    }
+
+    AsyncLogAppender::~AsyncLogAppender()
+    {
+        LogCrashHandler::Unregister(this);
+        stop();
+    }
+
+    void AsyncLogAppender::flushOnCrash()
+    {
+        // 格式化要分配内存，信号处理函数里做不了，只能等后台线程消费完
+        // 崩溃的就是后台线程，或它在等崩溃线程持有的锁时，超时放弃
+        struct timespec ts = {0, 1000 * 1000};
+        for (int i = 0; i < 1000 && (size() > 0 || !m_sleeping.load()) && !m_stopping.load(); ++i)
+        {
+            nanosleep(&ts, nullptr);
+        }
+        for (auto &i : m_appenders)
+        {
+            i->flushOnCrash();
+        }
+    }
+
+    void AsyncLogAppender::stop()
+    {
+        if (m_stopping.exchange(true))
+        {
+            return;
+        }
+        m_sleeping.store(false);
+        m_semaphore.notify();
+        m_thread->join();
+    }
+
+    void AsyncLogAppender::addAppender(LogAppender::ptr appender)
+    {
+        MutexType::Lock lock(m_mutex);
+        if (m_formatter)
+        {
+            appender->setDefaultFormatter(m_formatter);
+        }
+        m_appenders.push_back(appender);
+        m_appendersVersion.fetch_add(1, std::memory_order_release);
+    }
+
+    void AsyncLogAppender::setDefaultFormatter(LogFormatter::ptr formatter)
+    {
+        LogAppender::setDefaultFormatter(formatter);
+        MutexType::Lock lock(m_mutex);
+        for (auto &i : m_appenders)
+        {
+            i->setDefaultFormatter(m_formatter);
+        }
+    }
+
+    // Vyukov有界队列：每个槽位的序号标记该槽可写(seq == pos)或可读(seq == pos + 1)
+    bool AsyncLogAppender::tryPush(Item &item)
+    {
+        size_t pos = m_head.load(std::memory_order_relaxed);
+        Slot *slot;
+        while (true)
+        {
+            slot = &m_slots[pos & m_mask];
+            size_t seq = slot->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0)
+            {
+                if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                // 队列已满
+                return false;
+            }
+            else
+            {
+                pos = m_head.load(std::memory_order_relaxed);
+            }
+        }
+        slot->item = std::move(item);
+        slot->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 只有后台线程消费，读位置不需要CAS
+    bool AsyncLogAppender::tryPop(Item &item)
+    {
+        size_t pos = m_tail.load(std::memory_order_relaxed);
+        Slot *slot = &m_slots[pos & m_mask];
+        if (slot->seq.load(std::memory_order_acquire) != pos + 1)
+        {
+            return false;
+        }
+        item = std::move(slot->item);
+        slot->seq.store(pos + m_mask + 1, std::memory_order_release);
+        m_tail.store(pos + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    size_t AsyncLogAppender::size() const
+    {
+        return m_head.load(std::memory_order_relaxed) - m_tail.load(std::memory_order_relaxed);
+    }
+
+    void AsyncLogAppender::wakeup()
+    {
+        // 消费者睡眠时才需要信号量，避免每条日志一次系统调用
+        if (m_sleeping.load() && m_sleeping.exchange(false))
+        {
+            m_semaphore.notify();
+        }
+    }
+
+    void AsyncLogAppender::log(Logger *logger, LogLevel::Level level, const LogEvent::ptr &event)
+    {
+        if (level < getLevel())
+        {
+            return;
+        }
+        if (m_stopping.load(std::memory_order_relaxed))
+        {
+            ++m_dropped;
+            return;
+        }
+        if (m_policy == DROP_DEBUG_FIRST && level <= LogLevel::DEBUG && size() >= (m_mask + 1) / 4 * 3)
+        {
+            ++m_dropped;
+            return;
+        }
+        Item item;
+        item.level = level;
+        item.event = event;
+        while (!tryPush(item))
+        {
+            if (m_policy == DROP_NEWEST || (m_policy == DROP_DEBUG_FIRST && level <= LogLevel::DEBUG) || m_stopping.load(std::memory_order_relaxed))
+            {
+                ++m_dropped;
+                return;
+            }
+            wakeup();
+            sched_yield();
+        }
+        wakeup();
+    }
+
+    void AsyncLogAppender::run()
+    {
+        Item item;
+        // 内部appender列表的本地副本，列表变化时在锁内重新拷贝，输出时不持锁
+        std::vector<LogAppender::ptr> appenders;
+        uint64_t version = 0;
+        while (true)
+        {
+            if (tryPop(item))
+            {
+                if (m_appendersVersion.load(std::memory_order_acquire) != version)
+                {
+                    MutexType::Lock lock(m_mutex);
+                    appenders = m_appenders;
+                    version = m_appendersVersion.load(std::memory_order_relaxed);
+                }
+                for (auto &i : appenders)
+                {
+                    i->log(item.event->getLogger().get(), item.level, item.event);
+                }
+                item.event.reset();
+                continue;
+            }
+            if (m_stopping.load())
+            {
+                // stop之后入队的事件已被丢弃，这里队列已经排空
+                break;
+            }
+            // 先声明要睡眠，再检查一次队列，和生产者的wakeup配对避免丢失唤醒
+            m_sleeping.store(true);
+            if (size() > 0 || m_stopping.load())
+            {
+                m_sleeping.store(false);
+                continue;
+            }
+            m_semaphore.wait();
+        }
+    }
+
+    std::string AsyncLogAppender::toYamlString()
+    {
+        MutexType::Lock lock(m_mutex);
+        YAML::Node node;
+        node["type"] = "AsyncLogAppender";
+        node["capacity"] = getCapacity();
+        node["overflow"] = ToString(m_policy);
+        if (getLevel() != LogLevel::UNKOWN)
+        {
+            node["level"] = LogLevel::ToString(getLevel());
+        }
+        if (m_hasFormatter && m_formatter)
+        {
+            node["formatter"] = m_formatter->getPattern();
+        }
+        for (auto &i : m_appenders)
+        {
+            node["appenders"].push_back(YAML::Load(i->toYamlString()));
+        }
+        std::stringstream ss;
+        ss << node;
         return ss.str();
     }
 
-    LogFormatter::LogFormatter(const std::string &pattern) : m_pattern(pattern)
+    LogFormatter::LogFormatter(const std::string &pattern) : m_pattern(pattern)
+    {
+        init();
+    }
+
+    std::string LogFormatter::format(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event)
+    {
+        std::string buf;
+        format(buf, level, *event);
+        return buf;
+    }
+
+    void LogFormatter::format(std::string &buf, LogLevel::Level level, const LogEvent &event) const
+    {
+        for (auto &op : m_ops)
+        {
+            switch (op.code)
+            {
+            case OP_STRING:
+                buf.append(m_literals.data() + op.offset, op.length);
+                break;
+            case OP_MESSAGE:
+                buf.append(event.getContentData(), event.getContentSize());
+                break;
+            case OP_LEVEL:
+                buf.append(LogLevel::ToString(level));
+                break;
+            case OP_ELAPSE:
+                AppendUInt(buf, event.getElapse());
+                break;
+            case OP_NAME:
+                buf.append(event.getLogger()->getName());
+                break;
+            case OP_THREAD_ID:
+                AppendUInt(buf, event.getThreadId());
+                break;
+            case OP_NEWLINE:
+                buf.push_back('\n');
+                break;
+            case OP_DATETIME:
+                formatDate(buf, m_dates[op.offset], event.getTimeUs());
+                break;
+            case OP_FILENAME:
+                buf.append(event.getFile());
+                break;
+            case OP_LINE:
+                buf.append(event.getSite()->lineStr);
+                break;
+            case OP_BASENAME:
+                buf.append(event.getBaseName());
+                break;
+            case OP_FUNCTION:
+                buf.append(event.getFunction());
+                break;
+            case OP_TAB:
+                buf.push_back('\t');
+                break;
+            case OP_FIBER_ID:
+                AppendUInt(buf, event.getFiberId());
+                break;
+            case OP_THREAD_NAME:
+                buf.append(event.getThreadName());
+                break;
+            case OP_JSON:
+                formatJson(buf, m_dates[op.offset], level, event);
+                break;
+            case OP_LOGFMT:
+                formatLogfmt(buf, event);
+                break;
+            case OP_MDC:
+                formatMdc(buf, op, event);
+                break;
+            }
+        }
+    }
+
+    // 字段值，json为false时按logfmt规则输出
+    static void AppendFieldValue(std::string &buf, const LogEvent &event, const LogEvent::Field &field, bool json)
+    {
+        switch (field.type)
+        {
+        case LogEvent::FIELD_INT:
+            AppendInt(buf, field.i);
+            break;
+        case LogEvent::FIELD_UINT:
+            AppendUInt(buf, field.u);
+            break;
+        case LogEvent::FIELD_DOUBLE:
+            AppendDouble(buf, field.d, json);
+            break;
+        case LogEvent::FIELD_BOOL:
+            buf.append(field.u ? "true" : "false");
+            break;
+        case LogEvent::FIELD_STRING:
+        {
+            const char *str = event.getFieldString(field);
+            if (!json && !LogfmtNeedsQuote(str, field.s.len))
+            {
+                buf.append(str, field.s.len);
+                break;
+            }
+            buf.push_back('"');
+            AppendJsonEscaped(buf, str, field.s.len);
+            buf.push_back('"');
+            break;
+        }
+        }
+    }
+
+    void LogFormatter::formatJson(std::string &buf, const DateFormat &date, LogLevel::Level level, const LogEvent &event) const
+    {
+        buf.append("{\"time\":\"");
+        formatDate(buf, date, event.getTimeUs());
+        buf.append("\",\"level\":\"");
+        buf.append(LogLevel::ToString(level));
+        buf.append("\",\"logger\":\"");
+        const std::string &name = event.getLogger()->getName();
+        AppendJsonEscaped(buf, name.data(), name.size());
+        buf.append("\",\"thread\":");
+        AppendUInt(buf, event.getThreadId());
+        buf.append(",\"thread_name\":\"");
+        AppendJsonEscaped(buf, event.getThreadName().data(), event.getThreadName().size());
+        buf.append("\",\"fiber\":");
+        AppendUInt(buf, event.getFiberId());
+        buf.append(",\"file\":\"");
+        AppendJsonEscaped(buf, event.getFile(), strlen(event.getFile()));
+        buf.append("\",\"line\":");
+        AppendInt(buf, event.getLine());
+        buf.append(",\"msg\":\"");
+        AppendJsonEscaped(buf, event.getContentData(), event.getContentSize());
+        buf.push_back('"');
+        for (size_t i = 0; i < event.getFieldCount(); ++i)
+        {
+            const LogEvent::Field &field = event.getField(i);
+            buf.append(",\"");
+            AppendJsonEscaped(buf, event.getFieldKey(field), field.keyLen);
+            buf.append("\":");
+            AppendFieldValue(buf, event, field, true);
+        }
+        const LogMdc &mdc = event.getMdc();
+        if (mdc.size())
+        {
+            buf.append(",\"mdc\":{");
+            for (size_t i = 0; i < mdc.size(); ++i)
+            {
+                const LogMdc::Entry &entry = mdc.get(i);
+                buf.append(i ? ",\"" : "\"");
+                AppendJsonEscaped(buf, entry.key, entry.keyLen);
+                buf.append("\":\"");
+                AppendJsonEscaped(buf, entry.value, entry.valueLen);
+                buf.push_back('"');
+            }
+            buf.push_back('}');
+        }
+        buf.push_back('}');
+    }
+
+    void LogFormatter::formatLogfmt(std::string &buf, const LogEvent &event) const
+    {
+        for (size_t i = 0; i < event.getFieldCount(); ++i)
+        {
+            const LogEvent::Field &field = event.getField(i);
+            if (i)
+            {
+                buf.push_back(' ');
+            }
+            buf.append(event.getFieldKey(field), field.keyLen);
+            buf.push_back('=');
+            AppendFieldValue(buf, event, field, false);
+        }
+    }
+
+    void LogFormatter::formatMdc(std::string &buf, const Op &op, const LogEvent &event) const
+    {
+        const LogMdc &mdc = event.getMdc();
+        if (op.length)
+        {
+            const LogMdc::Entry *entry = mdc.find(m_literals.data() + op.offset, op.length);
+            if (entry)
+            {
+                buf.append(entry->value, entry->valueLen);
+            }
+            return;
+        }
+        for (size_t i = 0; i < mdc.size(); ++i)
+        {
+            const LogMdc::Entry &entry = mdc.get(i);
+            if (i)
+            {
+                buf.push_back(' ');
+            }
+            buf.append(entry.key, entry.keyLen);
+            buf.push_back('=');
+            buf.append(entry.value, entry.valueLen);
+        }
+    }
+
+    // 每个线程按时间格式缓存最近一秒渲染好的日期，秒数变化时才重新strftime
+    // 平凡类型，thread_local不需要动态初始化
+    struct DateCache
+    {
+        uint64_t id;
+        uint64_t sec;
+        uint16_t prefixLen;
+        uint16_t suffixLen;
+        char buf[128];
+    };
+    static const size_t s_date_cache_size = 8;
+    static thread_local DateCache t_date_cache[s_date_cache_size];
+    static std::atomic<uint64_t> s_date_format_id{0};
+
+    void LogFormatter::formatDate(std::string &buf, const DateFormat &date, uint64_t time_us) const
+    {
+        uint64_t sec = time_us / 1000000;
+        DateCache &cache = t_date_cache[date.id % s_date_cache_size];
+        if (cache.id != date.id || cache.sec != sec)
+        {
+            struct tm tm;
+            time_t time = sec;
+            localtime_r(&time, &tm);
+            cache.prefixLen = strftime(cache.buf, 64, date.prefix.c_str(), &tm);
+            cache.suffixLen = date.suffix.empty() ? 0 : strftime(cache.buf + 64, 64, date.suffix.c_str(), &tm);
+            cache.id = date.id;
+            cache.sec = sec;
+        }
+        buf.append(cache.buf, cache.prefixLen);
+        if (date.digits)
+        {
+            uint64_t frac = time_us % 1000000;
+            if (date.digits == 3)
+            {
+                frac /= 1000;
+            }
+            char tmp[6];
+            for (int i = date.digits - 1; i >= 0; --i)
+            {
+                tmp[i] = (char)('0' + frac % 10);
+                frac /= 10;
+            }
+            buf.append(tmp, date.digits);
+            buf.append(cache.buf + 64, cache.suffixLen);
+        }
+    }
+
+    void LogFormatter::addDateFormat(OpCode code, const std::string &fmt)
     {
-        init();
+        DateFormat date;
+        date.id = ++s_date_format_id;
+        date.prefix = fmt;
+        // 找第一个%3N(毫秒)或%6N(微秒)，跳过%%转义
+        for (size_t i = 0; i + 1 < fmt.size(); ++i)
+        {
+            if (fmt[i] != '%')
+            {
+                continue;
+            }
+            if (fmt[i + 1] == '%')
+            {
+                ++i;
+                continue;
+            }
+            if (i + 2 < fmt.size() && fmt[i + 2] == 'N' && (fmt[i + 1] == '3' || fmt[i + 1] == '6'))
+            {
+                date.prefix = fmt.substr(0, i);
+                date.digits = fmt[i + 1] - '0';
+                date.suffix = fmt.substr(i + 3);
+                break;
+            }
+        }
+        Op op;
+        op.code = code;
+        op.offset = m_dates.size();
+        m_dates.push_back(date);
+        m_ops.push_back(op);
     }
 
-    std::string LogFormatter::format(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event)
+    void LogFormatter::addLiteral(OpCode code, const std::string &str)
     {
-        std::stringstream ss;
-        for (auto &it : m_items)
-        {
-            it->format(ss, logger, level, event);
-        }
-        return ss.str();
+        Op op;
+        op.code = code;
+        op.offset = m_literals.size();
+        op.length = str.size();
+        m_literals.append(str);
+        m_ops.push_back(op);
     }
 
     //%X %X{} %X[X]
@@ -471,10 +3933,15 @@ namespace sake
      * %c -- 日志名称
      * %t -- 线程Id
      * %n -- 回车
-     * %d -- 时间
+     * %d -- 时间，%d{...}内为strftime格式，另支持%3N毫秒、%6N微秒
      * %f -- 文件名
      * %l -- 行号
      * %T -- Tab
+     * %F -- 协程Id
+     * %N -- 线程名称
+     * %J -- 整条事件输出为JSON对象(含结构化字段)，%J{...}内为时间格式，默认ISO 8601
+     * %K -- 结构化字段，logfmt格式
+     * %X -- 诊断上下文，%X{key}输出key的值，不带{}时按key=value输出全部
      * */
 
     void LogFormatter::init()
@@ -568,85 +4035,628 @@ namespace sake
         {
             vec.push_back(std::make_tuple(nstr, "", 0));
         }
-        // 映射，不同标识符->不同FormatItem
-        static std::map<std::string, std::function<FormatItem::ptr(const std::string &str)>> s_format_items = {
-#define XX(str, C)                                                               \
-    {                                                                            \
-        #str, [](const std::string &fmt) { return FormatItem::ptr(new C(fmt)); } \
-    }
-
-            XX(m, MessageFormatItem),   // p: 消息
-            XX(p, LevelFormatItem),     // r: 日志级别
-            XX(r, ElapseFormatItem),    // c: 累计毫秒数
-            XX(c, NameFormatItem),      // t: 日志名称
-            XX(t, ThreadIdFormatItem),  // n: 线程ID
-            XX(n, NewLineFormatItem),   // n: 回车
-            XX(d, DateTimeFormatItem),  // d: 时间
-            XX(f, FileNameFormatItem),  // f: 文件名
-            XX(l, LineFormatItem),      // l: 行号
-            XX(T, TabFormatItem),       // T: Tab
-            XX(F, FiberFormatItem),     // F: 协程ID
-            XX(N, ThreadNameFormatItem) // N: 协程名称
+        // 映射，不同标识符->不同指令
+        static std::map<std::string, OpCode> s_format_ops = {
+#define XX(str, C) \
+    {              \
+        #str, C    \
+    }
+
+            XX(m, OP_MESSAGE),    // m: 消息
+            XX(p, OP_LEVEL),      // p: 日志级别
+            XX(r, OP_ELAPSE),     // r: 累计毫秒数
+            XX(c, OP_NAME),       // c: 日志名称
+            XX(t, OP_THREAD_ID),  // t: 线程ID
+            XX(n, OP_NEWLINE),    // n: 回车
+            XX(d, OP_DATETIME),   // d: 时间
+            XX(f, OP_FILENAME),   // f: 文件名
+            XX(l, OP_LINE),       // l: 行号
+            XX(T, OP_TAB),        // T: Tab
+            XX(F, OP_FIBER_ID),   // F: 协程ID
+            XX(N, OP_THREAD_NAME), // N: 线程名称
+            XX(J, OP_JSON),        // J: JSON
+            XX(K, OP_LOGFMT),      // K: logfmt字段
+            XX(b, OP_BASENAME),    // b: 不带目录的文件名
+            XX(M, OP_FUNCTION),    // M: 函数名
+            XX(X, OP_MDC)          // X: 诊断上下文
 
 #undef XX
         };
 
+        m_ops.clear();
+        m_literals.clear();
+        m_dates.clear();
         for (auto &i : vec)
         {
             // type
             if (std::get<2>(i) == 0)
             {
-                m_items.push_back(FormatItem::ptr(new StringFormatItem(std::get<0>(i))));
+                addLiteral(OP_STRING, std::get<0>(i));
+                continue;
+            }
+            auto it = s_format_ops.find(std::get<0>(i));
+            if (it == s_format_ops.end())
+            {
+                addLiteral(OP_STRING, "<<error_format %" + std::get<0>(i) + ">>");
+                m_isError = true;
+            }
+            else if (it->second == OP_DATETIME)
+            {
+                std::string fmt = std::get<1>(i);
+                if (fmt.empty())
+                {
+                    fmt = "%Y-%m-%d %H:%M%S";
+                }
+                addDateFormat(OP_DATETIME, fmt);
+            }
+            else if (it->second == OP_JSON)
+            {
+                std::string fmt = std::get<1>(i);
+                if (fmt.empty())
+                {
+                    fmt = "%Y-%m-%dT%H:%M:%S.%6N%z";
+                }
+                addDateFormat(OP_JSON, fmt);
+            }
+            else if (it->second == OP_MDC)
+            {
+                addLiteral(OP_MDC, std::get<1>(i));
+            }
+            else
+            {
+                Op op;
+                op.code = it->second;
+                m_ops.push_back(op);
+            }
+        }
+    }
+
+    LogEventWrap::LogEventWrap(LogEvent::ptr e) : m_event(e)
+    {
+    }
+
+    LogEventWrap::LogEventWrap(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogSite *site)
+        : m_event(LogEventPool::Acquire())
+    {
+        m_event->reset(logger, level, site, 0, util::GetThreadId(), util::GetFiberId(), util::GetCurrentUS(), Thread::GetName());
+    }
+
+    LogEventWrap::LogEventWrap(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const char *file, int32_t line)
+        : LogEventWrap(logger, level, LogSite::Intern(file, line))
+    {
+    }
+
+    LogEventWrap::~LogEventWrap()
+    {
+        m_event->getLogger()->log(m_event->getLevel(), m_event);
+        // 释放引用，池化的事件在这里(或异步appender处理完后)重新可用
+        m_event.reset();
+    }
+
+    std::ostream &LogEventWrap::getSS()
+    {
+        return m_event->getSS();
+    }
+
+    std::ostream &operator<<(std::ostream &os, const LogLimitPass &pass)
+    {
+        if (pass.suppressed)
+        {
+            os << "[suppressed " << pass.suppressed << "] ";
+        }
+        return os;
+    }
+
+    LogLimitPass LogEveryMs::tryPass()
+    {
+        uint64_t now = MonotonicNs() / 1000;
+        uint64_t next = m_next.load(std::memory_order_relaxed);
+        // 同一时刻只有CAS成功的线程放行
+        if (now >= next && m_next.compare_exchange_strong(next, now + m_interval, std::memory_order_relaxed))
+        {
+            return LogLimitPass(true, m_suppressed.exchange(0, std::memory_order_relaxed));
+        }
+        m_suppressed.fetch_add(1, std::memory_order_relaxed);
+        return LogLimitPass(false);
+    }
+
+    LogRateLimit::LogRateLimit(double rate, uint64_t burst)
+    {
+        // rate不大于0时按一年一个令牌算，实际只放行burst条
+        m_interval = rate > 0 ? std::max((uint64_t)(1e9 / rate), (uint64_t)1) : 365ull * 86400 * 1000000000;
+        m_tolerance = burst > 1 ? m_interval * (burst - 1) : 0;
+    }
+
+    LogLimitPass LogRateLimit::tryPass()
+    {
+        uint64_t now = MonotonicNs();
+        uint64_t tat = m_tat.load(std::memory_order_relaxed);
+        while (true)
+        {
+            // 理论到达时间超前当前时间超过容忍度，说明令牌已用完
+            uint64_t start = std::max(tat, now);
+            if (start - now > m_tolerance)
+            {
+                m_suppressed.fetch_add(1, std::memory_order_relaxed);
+                return LogLimitPass(false);
+            }
+            if (m_tat.compare_exchange_weak(tat, start + m_interval, std::memory_order_relaxed))
+            {
+                return LogLimitPass(true, m_suppressed.exchange(0, std::memory_order_relaxed));
+            }
+        }
+    }
+
+    static const uint64_t s_dedup_sweep_interval_us = 10 * 1000;
+
+    // 所有LogDedup共用的后台线程，汇报已结束的窗口
+    class LogDedupSweeper
+    {
+    public:
+        void add(LogDedup *dedup)
+        {
+            Mutex::Lock lock(m_mutex);
+            m_dedups.push_back(dedup);
+            if (!m_thread)
+            {
+                m_thread.reset(new Thread(std::bind(&LogDedupSweeper::run, this), "log_dedup"));
+            }
+        }
+
+        // 返回后后台线程不会再访问dedup
+        void del(LogDedup *dedup)
+        {
+            Mutex::Lock lock(m_mutex);
+            m_dedups.erase(std::remove(m_dedups.begin(), m_dedups.end(), dedup), m_dedups.end());
+        }
+
+        void sweep(bool all)
+        {
+            Mutex::Lock lock(m_mutex);
+            for (auto i : m_dedups)
+            {
+                i->sweep(all);
+            }
+        }
+
+    private:
+        void run()
+        {
+            while (true)
+            {
+                usleep(s_dedup_sweep_interval_us);
+                sweep(false);
+            }
+        }
+
+    private:
+        Mutex m_mutex;
+        std::vector<LogDedup *> m_dedups;
+        std::unique_ptr<Thread> m_thread;
+    };
+
+    static LogDedupSweeper &GetLogDedupSweeper()
+    {
+        // 不析构，后台线程一直运行到进程退出；退出时汇报所有窗口
+        static LogDedupSweeper *s_sweeper = []()
+        {
+            LogDedupSweeper *sweeper = new LogDedupSweeper;
+            atexit([]()
+                   { GetLogDedupSweeper().sweep(true); });
+            return sweeper;
+        }();
+        return *s_sweeper;
+    }
+
+    static const uint64_t s_dedup_count_mask = 0xffffffffull;
+
+    // 每次处理8字节，消息只在这里完整读一遍
+    static uint64_t DedupHash(const char *data, size_t len, uint64_t seed)
+    {
+        const uint64_t m = 0x9e3779b97f4a7c15ull;
+        uint64_t h = seed ^ (len * m);
+        uint64_t k;
+        for (; len >= 8; data += 8, len -= 8)
+        {
+            memcpy(&k, data, 8);
+            h = (h ^ k) * m;
+            h ^= h >> 29;
+        }
+        if (len)
+        {
+            k = 0;
+            memcpy(&k, data, len);
+            h = (h ^ k) * m;
+            h ^= h >> 29;
+        }
+        h ^= h >> 32;
+        h *= m;
+        h ^= h >> 29;
+        return h;
+    }
+
+    LogDedup::LogDedup(uint32_t window_ms, size_t slots, Reporter reporter)
+        : m_window((uint64_t)std::max(window_ms, 1u) * 1000), m_shardSlots(RoundSlots(slots) / SHARDS), m_reporter(reporter)
+    {
+        for (auto &i : m_shards)
+        {
+            i.reset(new Slot[m_shardSlots]);
+        }
+        GetLogDedupSweeper().add(this);
+    }
+
+    LogDedup::~LogDedup()
+    {
+        GetLogDedupSweeper().del(this);
+        sweep(true);
+    }
+
+    size_t LogDedup::RoundSlots(size_t slots)
+    {
+        size_t shard_slots = PROBE;
+        while (shard_slots * SHARDS < slots)
+        {
+            shard_slots <<= 1;
+        }
+        return shard_slots * SHARDS;
+    }
+
+    bool LogDedup::AddRepeat(Slot &slot, uint64_t state, uint64_t tag)
+    {
+        while ((state & ~s_dedup_count_mask) == tag)
+        {
+            // 计数到上限后不再增加，仍算重复
+            if ((state & s_dedup_count_mask) == s_dedup_count_mask ||
+                slot.state.compare_exchange_weak(state, state + 1, std::memory_order_relaxed))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool LogDedup::check(LogLevel::Level level, const LogEvent &event)
+    {
+        const char *data = event.getContentData();
+        size_t len = event.getContentSize();
+        uint64_t hash = DedupHash(data, len, (uint64_t)(uintptr_t)event.getSite() * 31 + level);
+        // 低位选分片，中间选槽位，高位作标签
+        uint64_t tag = ((hash >> 32) | 1) << 32;
+        Slot *shard = m_shards[hash % SHARDS].get();
+        size_t mask = m_shardSlots - 1;
+        size_t index = (hash >> 4) & mask;
+        Slot *empty = nullptr;
+        for (size_t i = 0; i < PROBE; ++i)
+        {
+            Slot &slot = shard[(index + i) & mask];
+            uint64_t state = slot.state.load(std::memory_order_relaxed);
+            if (AddRepeat(slot, state, tag))
+            {
+                return false;
+            }
+            if (!state && !empty)
+            {
+                empty = &slot;
+            }
+        }
+        if (!empty)
+        {
+            // 探测范围内都被占用，不去重
+            return true;
+        }
+        uint64_t state = 0;
+        if (!empty->state.compare_exchange_strong(state, tag, std::memory_order_acquire))
+        {
+            // 同一条消息被其他线程抢先登记时算重复；被别的消息占用时放行
+            return !AddRepeat(*empty, state, tag);
+        }
+        empty->site = event.getSite();
+        empty->level = level;
+        if (len > TEXT_SIZE)
+        {
+            len = TEXT_SIZE - 3;
+            memcpy(empty->text + len, "...", 3);
+            empty->len = TEXT_SIZE;
+        }
+        else
+        {
+            empty->len = len;
+        }
+        memcpy(empty->text, data, len);
+        empty->expire.store(MonotonicNs() / 1000 + m_window, std::memory_order_release);
+        return true;
+    }
+
+    void LogDedup::sweep(bool all)
+    {
+        Mutex::Lock lock(m_sweepMutex);
+        uint64_t now = MonotonicNs() / 1000;
+        char text[TEXT_SIZE];
+        for (auto &shard : m_shards)
+        {
+            for (size_t i = 0; i < m_shardSlots; ++i)
+            {
+                Slot &slot = shard[i];
+                uint64_t expire = slot.expire.load(std::memory_order_acquire);
+                if (!expire || (!all && now < expire))
+                {
+                    continue;
+                }
+                // 释放槽位前内容不会再变，先拷出来，释放后可能立即被新消息占用
+                LogLevel::Level level = slot.level;
+                const LogSite *site = slot.site;
+                size_t len = slot.len;
+                memcpy(text, slot.text, len);
+                slot.expire.store(0, std::memory_order_relaxed);
+                uint64_t repeats = slot.state.exchange(0, std::memory_order_release) & s_dedup_count_mask;
+                if (repeats)
+                {
+                    m_reporter(level, site, repeats, text, len);
+                }
+            }
+        }
+    }
+
+    void LogEvent::format(const char *fmt, ...)
+    {
+        va_list args;
+        va_start(args, fmt);
+        format(fmt, args);
+        va_end(args);
+    }
+
+    void LogEvent::format(const char *fmt, va_list args)
+    {
+        // 先按剩余空间格式化一次，放不下再按实际长度扩容重来
+        LogStreamBuf &buf = m_ss.getBuf();
+        va_list copy;
+        va_copy(copy, args);
+        size_t avail = buf.available();
+        int len = vsnprintf(buf.prepare(0), avail, fmt, args);
+        if (len >= 0 && (size_t)len >= avail)
+        {
+            vsnprintf(buf.prepare(len + 1), len + 1, fmt, copy);
+        }
+        va_end(copy);
+        if (len > 0)
+        {
+            buf.commit(len);
+        }
+    }
+
+    const char *LogEvent::printText(const char *fmt)
+    {
+        const char *p = fmt;
+        while (true)
+        {
+            const char *brace = strpbrk(p, "{}");
+            if (!brace)
+            {
+                m_ss.write(fmt, strlen(fmt));
+                return nullptr;
+            }
+            if (brace[0] == '{' && brace[1] == '}')
+            {
+                m_ss.write(fmt, brace - fmt);
+                return brace + 2;
+            }
+            if (brace[1] == brace[0])
+            {
+                // {{ 或 }} 输出一个
+                m_ss.write(fmt, brace - fmt + 1);
+                fmt = p = brace + 2;
             }
             else
             {
-                auto it = s_format_items.find(std::get<0>(i));
-                if (it == s_format_items.end())
+                p = brace + 1;
+            }
+        }
+    }
+
+    // 崩溃时要处理的appender，定长数组，信号处理函数里只做原子读
+    static const size_t s_crash_slots = 256;
+    static std::atomic<LogAppender *> s_crash_appenders[s_crash_slots];
+    static std::atomic<LogAppender *> s_crash_last_appenders[s_crash_slots];
+    static std::atomic<int> s_crash_fd{STDERR_FILENO};
+    static std::atomic<bool> s_crashing{false};
+
+    static void CrashRegister(std::atomic<LogAppender *> *slots, LogAppender *appender)
+    {
+        for (size_t i = 0; i < s_crash_slots; ++i)
+        {
+            LogAppender *expected = nullptr;
+            if (slots[i].compare_exchange_strong(expected, appender))
+            {
+                return;
+            }
+        }
+        // 登记表满时该appender崩溃时不会被写出
+    }
+
+    void LogCrashHandler::Register(LogAppender *appender, bool last)
+    {
+        CrashRegister(last ? s_crash_last_appenders : s_crash_appenders, appender);
+    }
+
+    void LogCrashHandler::Unregister(LogAppender *appender)
+    {
+        for (size_t i = 0; i < s_crash_slots; ++i)
+        {
+            LogAppender *expected = appender;
+            if (s_crash_appenders[i].compare_exchange_strong(expected, nullptr))
+            {
+                return;
+            }
+            expected = appender;
+            if (s_crash_last_appenders[i].compare_exchange_strong(expected, nullptr))
+            {
+                return;
+            }
+        }
+    }
+
+    void LogCrashHandler::Flush()
+    {
+        for (auto slots : {s_crash_appenders, s_crash_last_appenders})
+        {
+            for (size_t i = 0; i < s_crash_slots; ++i)
+            {
+                LogAppender *appender = slots[i].load();
+                if (appender)
+                {
+                    appender->flushOnCrash();
+                }
+            }
+        }
+    }
+
+    // 以下只用异步信号安全的调用
+    static void CrashWrite(int fd, const char *str)
+    {
+        WriteAll(fd, str, strlen(str));
+    }
+
+    static void CrashWriteUInt(int fd, uint64_t v)
+    {
+        char buf[24];
+        char *p = buf + sizeof(buf);
+        do
+        {
+            *--p = '0' + v % 10;
+            v /= 10;
+        } while (v);
+        WriteAll(fd, p, buf + sizeof(buf) - p);
+    }
+
+    static void CrashWriteHex(int fd, uint64_t v)
+    {
+        char buf[24];
+        char *p = buf + sizeof(buf);
+        do
+        {
+            *--p = "0123456789abcdef"[v & 0xf];
+            v >>= 4;
+        } while (v);
+        *--p = 'x';
+        *--p = '0';
+        WriteAll(fd, p, buf + sizeof(buf) - p);
+    }
+
+    // 输出可执行段的映射，离线用addr2line把调用栈地址换算成符号
+    static void CrashWriteMaps(int fd)
+    {
+        int maps = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+        if (maps < 0)
+        {
+            return;
+        }
+        char buf[4096];
+        // 行首(含权限字段)攒在line里判断是否可执行，超长行的其余部分不再缓存，直接写出或跳过
+        char line[512];
+        size_t len = 0;
+        // 当前行超长时行首是否已写出，-1表示还在攒行首
+        int keep = -1;
+        ssize_t n;
+        while ((n = read(maps, buf, sizeof(buf))) > 0)
+        {
+            ssize_t i = 0;
+            while (i < n)
+            {
+                if (keep >= 0)
+                {
+                    const char *nl = (const char *)memchr(buf + i, '\n', n - i);
+                    ssize_t end = nl ? nl - buf + 1 : n;
+                    if (keep)
+                    {
+                        WriteAll(fd, buf + i, end - i);
+                    }
+                    i = end;
+                    if (nl)
+                    {
+                        keep = -1;
+                    }
+                    continue;
+                }
+                char c = buf[i++];
+                line[len++] = c;
+                if (c != '\n' && len < sizeof(line))
+                {
+                    continue;
+                }
+                // 地址范围后的权限字段第三位是x
+                const char *perms = (const char *)memchr(line, ' ', len);
+                bool exec = perms && perms + 4 < line + len && perms[3] == 'x';
+                if (exec)
                 {
-                    m_items.push_back(FormatItem::ptr(new StringFormatItem("<<error_format %" + std::get<0>(i) + ">>")));
-                    m_isError = true;
+                    WriteAll(fd, line, len);
                 }
-                else
+                len = 0;
+                if (c != '\n')
                 {
-                    // fmt
-                    m_items.push_back(it->second(std::get<1>(i)));
+                    keep = exec;
                 }
             }
-            // std::cout << "(" << std::get<0>(i) << ") - (" << std::get<1>(i) << ") - (" << std::get<2>(i) << ")" << std::endl;
         }
-        // std::cout << m_items.size() << std::endl;
+        close(maps);
     }
 
-    LogEventWrap::LogEventWrap(LogEvent::ptr e) : m_event(e)
+    static void CrashSignalHandler(int sig, siginfo_t *info, void *context)
     {
-    }
+        // 多个线程同时崩溃时只处理第一个，其余等待进程退出
+        if (s_crashing.exchange(true))
+        {
+            struct timespec ts = {1, 0};
+            while (true)
+            {
+                nanosleep(&ts, nullptr);
+            }
+        }
+        int fd = s_crash_fd.load();
+        CrashWrite(fd, "*** caught signal ");
+        CrashWriteUInt(fd, sig);
+        CrashWrite(fd, " (");
+        CrashWrite(fd, sig == SIGSEGV ? "SIGSEGV" : sig == SIGBUS ? "SIGBUS"
+                                                : sig == SIGFPE   ? "SIGFPE"
+                                                : sig == SIGILL   ? "SIGILL"
+                                                : sig == SIGABRT  ? "SIGABRT"
+                                                                  : "?");
+        CrashWrite(fd, ") tid ");
+        CrashWriteUInt(fd, syscall(SYS_gettid));
+        CrashWrite(fd, " addr ");
+        CrashWriteHex(fd, (uintptr_t)info->si_addr);
+        CrashWrite(fd, " ***\nbacktrace:\n");
+        util::BacktraceToFd(fd, 64, 1);
+        CrashWrite(fd, "maps:\n");
+        CrashWriteMaps(fd);
+        LogCrashHandler::Flush();
 
-    LogEventWrap::~LogEventWrap()
-    {
-        m_event->getLogger()->log(m_event->getLevel(), m_event);
+        // 恢复默认处理，信号在处理函数返回后重新投递，进程按原信号退出
+        signal(sig, SIG_DFL);
+        raise(sig);
     }
 
-    std::stringstream &LogEventWrap::getSS()
+    void LogCrashHandler::Install(int fd)
     {
-        return m_event->getSS();
-    }
+        s_crash_fd = fd;
+        // backtrace第一次调用时会加载libgcc，提前调用一次，信号处理函数里就不会再分配内存
+        void *dummy[1];
+        ::backtrace(dummy, 1);
 
-    void LogEvent::format(const char *fmt, ...)
-    {
-        va_list args;
-        va_start(args, fmt);
-        format(fmt, args);
-        va_end(args);
-    }
+        static char s_altstack[64 * 1024];
+        stack_t ss;
+        ss.ss_sp = s_altstack;
+        ss.ss_size = sizeof(s_altstack);
+        ss.ss_flags = 0;
+        sigaltstack(&ss, nullptr);
 
-    void LogEvent::format(const char *fmt, va_list args)
-    {
-        char *buf = nullptr;
-        int len = vasprintf(&buf, fmt, args);
-        if (len != -1)
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_sigaction = CrashSignalHandler;
+        sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+        sigemptyset(&sa.sa_mask);
+        for (int sig : {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT})
         {
-            m_ss << std::string(buf, len);
-            free(buf);
+            sigaction(sig, &sa, nullptr);
         }
     }
 
@@ -654,34 +4664,110 @@ namespace sake
     {
         m_root.reset(new Logger);
         m_root->addAppender(LogAppender::ptr(new StdoutLogAppender));
-        m_loggers[m_root->m_name] = m_root;
+        std::shared_ptr<LoggerMap> loggers(new LoggerMap);
+        (*loggers)[m_root->m_name] = m_root;
+        m_loggers.publish(loggers);
         init();
     }
 
     Logger::ptr LoggerManager::getLogger(const std::string &name)
     {
+        {
+            SnapshotPtr<LoggerMap>::ReadGuard loggers(m_loggers);
+            auto it = loggers->find(name);
+            if (it != loggers->end())
+            {
+                return it->second;
+            }
+        }
         MutexType::Lock lock(m_mutex);
-        auto it = m_loggers.find(name);
-        if (it != m_loggers.end())
+        // 加锁期间可能已被其他线程创建
+        std::shared_ptr<const LoggerMap> cur = m_loggers.get();
+        auto it = cur->find(name);
+        if (it != cur->end())
         {
             return it->second;
         }
         Logger::ptr logger(new Logger(name));
-        logger->m_root = m_root;
-        m_loggers[name] = logger;
+        {
+            // 最近的已存在祖先作为父节点
+            Logger::ptr parent = m_root;
+            for (size_t pos = name.rfind('.'); pos != std::string::npos && pos > 0; pos = name.rfind('.', pos - 1))
+            {
+                auto pit = cur->find(name.substr(0, pos));
+                if (pit != cur->end())
+                {
+                    parent = pit->second;
+                    break;
+                }
+            }
+            Logger::MutexType::Lock tree(GetLoggerTreeMutex());
+            Logger::MutexType::Lock lock(logger->m_mutex);
+            logger->m_level.store(LogLevel::UNKOWN, std::memory_order_relaxed);
+            logger->m_parent = parent;
+            logger->publishNoLock(Logger::AppenderList());
+            // 原来挂在parent下的后代改挂到新日志器
+            // 新日志器没有自己的配置，继承结果和parent相同，后代不用重算
+            std::string prefix = name + ".";
+            auto &children = parent->m_children;
+            for (auto it = children.begin(); it != children.end();)
+            {
+                if ((*it)->m_name.compare(0, prefix.size(), prefix) == 0)
+                {
+                    (*it)->m_parent = logger;
+                    logger->m_children.push_back(*it);
+                    it = children.erase(it);
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+            children.push_back(logger.get());
+        }
+        std::shared_ptr<LoggerMap> loggers(new LoggerMap(*cur));
+        (*loggers)[name] = logger;
+        m_loggers.publish(loggers);
         return logger;
     }
 
     struct LogAppenderDefine
     {
-        int type; // 1 Fiel 2 Std
+        int type; // 1 Fiel 2 Std 3 Async 4 RollingFile 5 MmapFile 6 Binary 7 Shm 8 Socket
         LogLevel::Level level = LogLevel::UNKOWN;
         std::string formatter;
+        // 共享内存appender为shm对象名，socket appender为socket路径
         std::string file;
+        // 滚动文件appender参数
+        uint64_t max_size = 0;
+        uint32_t interval = 0;
+        uint32_t max_files = 0;
+        uint64_t preallocate = 0;
+        // 内存映射appender参数
+        uint64_t window = 16 * 1024 * 1024;
+        // 共享内存appender数据区大小
+        uint64_t shm_size = 4 * 1024 * 1024;
+        // socket appender参数
+        bool stream = false;
+        uint64_t spool_size = 4 * 1024 * 1024;
+        bool syslog = false;
+        // 文件、控制台appender批量写出参数，batch_size为0表示不批量
+        uint64_t batch_size = 0;
+        uint32_t batch_latency = 100;
+        LogLevel::Level flush_level = LogLevel::ERROR;
+        // 文件appender持久化(组提交)参数
+        bool durable = false;
+        uint32_t commit_interval = 0;
+        uint64_t commit_batch = 256 * 1024;
+        bool durable_wait = true;
+        // 异步appender参数
+        size_t capacity = 8192;
+        AsyncLogAppender::OverflowPolicy overflow = AsyncLogAppender::BLOCK;
+        std::vector<LogAppenderDefine> appenders;
 
         bool operator==(const LogAppenderDefine &oth) const
         {
-            return type == oth.type && level == oth.level && formatter == oth.formatter && file == oth.file;
+            return type == oth.type && level == oth.level && formatter == oth.formatter && file == oth.file && max_size == oth.max_size && interval == oth.interval && max_files == oth.max_files && preallocate == oth.preallocate && window == oth.window && shm_size == oth.shm_size && stream == oth.stream && spool_size == oth.spool_size && syslog == oth.syslog && batch_size == oth.batch_size && batch_latency == oth.batch_latency && flush_level == oth.flush_level && durable == oth.durable && commit_interval == oth.commit_interval && commit_batch == oth.commit_batch && durable_wait == oth.durable_wait && capacity == oth.capacity && overflow == oth.overflow && appenders == oth.appenders;
         }
     };
 
@@ -690,11 +4776,17 @@ namespace sake
         std::string name;
         LogLevel::Level level = LogLevel::UNKOWN;
         std::string formatter;
+        // 飞行记录每线程条数，0表示不开启
+        size_t recorder_size = 0;
+        LogLevel::Level recorder_level = LogLevel::DEBUG;
+        // 去重窗口(毫秒)，0表示不开启
+        uint32_t dedup_window = 0;
+        size_t dedup_slots = 4096;
         std::vector<LogAppenderDefine> appenders;
 
         bool operator==(const LogDefine &oth) const
         {
-            return name == oth.name && level == oth.level && formatter == oth.formatter && appenders == oth.appenders;
+            return name == oth.name && level == oth.level && formatter == oth.formatter && recorder_size == oth.recorder_size && recorder_level == oth.recorder_level && dedup_window == oth.dedup_window && dedup_slots == oth.dedup_slots && appenders == oth.appenders;
         }
         bool operator<(const LogDefine &oth) const
         {
@@ -702,6 +4794,319 @@ namespace sake
         }
     };
 
+    // 字节数，支持K/M/G后缀，如 64M
+    static uint64_t ParseByteSize(const std::string &str)
+    {
+        char *end = nullptr;
+        uint64_t v = strtoull(str.c_str(), &end, 10);
+        switch (toupper(*end))
+        {
+        case 'G':
+            v <<= 10;
+            // fall through
+        case 'M':
+            v <<= 10;
+            // fall through
+        case 'K':
+            v <<= 10;
+        default:
+            break;
+        }
+        return v;
+    }
+
+    // 时间窗口秒数，支持 minutely/hourly/daily
+    static uint32_t ParseInterval(const std::string &str)
+    {
+        if (str == "minutely")
+        {
+            return 60;
+        }
+        if (str == "hourly")
+        {
+            return 3600;
+        }
+        if (str == "daily")
+        {
+            return 86400;
+        }
+        return strtoul(str.c_str(), nullptr, 10);
+    }
+
+    // 批量写出参数
+    static void ParseBatch(const YAML::Node &node, LogAppenderDefine &lad)
+    {
+        if (node["batch_size"].IsDefined())
+        {
+            lad.batch_size = ParseByteSize(node["batch_size"].as<std::string>());
+        }
+        if (node["batch_latency"].IsDefined())
+        {
+            lad.batch_latency = node["batch_latency"].as<uint32_t>();
+        }
+        if (node["flush_level"].IsDefined())
+        {
+            lad.flush_level = LogLevel::FromString(node["flush_level"].as<std::string>());
+        }
+    }
+
+    // 持久化参数
+    static void ParseDurable(const YAML::Node &node, LogAppenderDefine &lad)
+    {
+        if (node["durable"].IsDefined())
+        {
+            lad.durable = node["durable"].as<bool>();
+        }
+        if (node["commit_interval"].IsDefined())
+        {
+            lad.commit_interval = node["commit_interval"].as<uint32_t>();
+        }
+        if (node["commit_batch"].IsDefined())
+        {
+            lad.commit_batch = ParseByteSize(node["commit_batch"].as<std::string>());
+        }
+        if (node["durable_wait"].IsDefined())
+        {
+            lad.durable_wait = node["durable_wait"].as<bool>();
+        }
+    }
+
+    // 解析appenders节点，异步appender的内部appenders递归解析
+    static void ParseAppenderDefines(const YAML::Node &node, std::vector<LogAppenderDefine> &appenders)
+    {
+        for (size_t j = 0; j < node.size(); ++j)
+        {
+            auto a = node[j];
+
+            if (!a["type"].IsDefined())
+            {
+                std::cout << "log conf error : appeners type is null" << a << std::endl;
+                continue;
+            }
+            std::string type = a["type"].as<std::string>();
+            LogAppenderDefine lad;
+            if (type == "FileLogAppender")
+            {
+                lad.type = 1;
+                if (!a["file"].IsDefined())
+                {
+                    std::cout << "log conf error : fileappener file is invalid" << a << std::endl;
+                    continue;
+                }
+                lad.file = a["file"].as<std::string>();
+                ParseBatch(a, lad);
+                ParseDurable(a, lad);
+            }
+            else if (type == "RollingFileLogAppender")
+            {
+                lad.type = 4;
+                if (!a["file"].IsDefined())
+                {
+                    std::cout << "log conf error : rollingfileappener file is invalid" << a << std::endl;
+                    continue;
+                }
+                lad.file = a["file"].as<std::string>();
+                if (a["max_size"].IsDefined())
+                {
+                    lad.max_size = ParseByteSize(a["max_size"].as<std::string>());
+                }
+                if (a["interval"].IsDefined())
+                {
+                    lad.interval = ParseInterval(a["interval"].as<std::string>());
+                }
+                if (a["max_files"].IsDefined())
+                {
+                    lad.max_files = a["max_files"].as<uint32_t>();
+                }
+                if (a["preallocate"].IsDefined())
+                {
+                    lad.preallocate = ParseByteSize(a["preallocate"].as<std::string>());
+                }
+            }
+            else if (type == "MmapFileLogAppender")
+            {
+                lad.type = 5;
+                if (!a["file"].IsDefined())
+                {
+                    std::cout << "log conf error : mmapfileappener file is invalid" << a << std::endl;
+                    continue;
+                }
+                lad.file = a["file"].as<std::string>();
+                if (a["window"].IsDefined())
+                {
+                    lad.window = ParseByteSize(a["window"].as<std::string>());
+                }
+            }
+            else if (type == "BinaryLogAppender")
+            {
+                lad.type = 6;
+                if (!a["file"].IsDefined())
+                {
+                    std::cout << "log conf error : binaryappener file is invalid" << a << std::endl;
+                    continue;
+                }
+                lad.file = a["file"].as<std::string>();
+            }
+            else if (type == "ShmLogAppender")
+            {
+                lad.type = 7;
+                if (!a["name"].IsDefined())
+                {
+                    std::cout << "log conf error : shmappener name is invalid" << a << std::endl;
+                    continue;
+                }
+                lad.file = a["name"].as<std::string>();
+                if (a["size"].IsDefined())
+                {
+                    lad.shm_size = ParseByteSize(a["size"].as<std::string>());
+                }
+            }
+            else if (type == "SocketLogAppender")
+            {
+                lad.type = 8;
+                if (!a["path"].IsDefined())
+                {
+                    std::cout << "log conf error : socketappener path is invalid" << a << std::endl;
+                    continue;
+                }
+                lad.file = a["path"].as<std::string>();
+                if (a["socket"].IsDefined())
+                {
+                    lad.stream = a["socket"].as<std::string>() == "stream";
+                }
+                if (a["spool"].IsDefined())
+                {
+                    lad.spool_size = ParseByteSize(a["spool"].as<std::string>());
+                }
+                if (a["syslog"].IsDefined())
+                {
+                    lad.syslog = a["syslog"].as<bool>();
+                }
+            }
+            else if (type == "StdoutLogAppender" || type == "StdLogAppender")
+            {
+                lad.type = 2;
+                ParseBatch(a, lad);
+            }
+            else if (type == "AsyncLogAppender")
+            {
+                lad.type = 3;
+                if (a["capacity"].IsDefined())
+                {
+                    lad.capacity = a["capacity"].as<size_t>();
+                }
+                if (a["overflow"].IsDefined())
+                {
+                    lad.overflow = AsyncLogAppender::PolicyFromString(a["overflow"].as<std::string>());
+                }
+                if (a["appenders"].IsDefined())
+                {
+                    ParseAppenderDefines(a["appenders"], lad.appenders);
+                }
+                if (lad.appenders.empty())
+                {
+                    std::cout << "log conf error : asyncappender appenders is null" << a << std::endl;
+                    continue;
+                }
+            }
+            else
+            {
+                std::cout << "log conf error : appeners type is invalid" << a << std::endl;
+                continue;
+            }
+            if (a["level"].IsDefined())
+            {
+                lad.level = LogLevel::FromString(a["level"].as<std::string>());
+            }
+            if (a["formatter"].IsDefined())
+            {
+                lad.formatter = a["formatter"].as<std::string>();
+            }
+            appenders.push_back(lad);
+        }
+    }
+
+    static YAML::Node AppenderDefineToYaml(const LogAppenderDefine &a)
+    {
+        YAML::Node na;
+        if (a.type == 1)
+        {
+            na["type"] = "FileLogAppender";
+            na["file"] = a.file;
+        }
+        else if (a.type == 2)
+        {
+            na["type"] = "StdoutLogAppender";
+        }
+        else if (a.type == 4)
+        {
+            na["type"] = "RollingFileLogAppender";
+            na["file"] = a.file;
+            na["max_size"] = a.max_size;
+            na["interval"] = a.interval;
+            na["max_files"] = a.max_files;
+            na["preallocate"] = a.preallocate;
+        }
+        else if (a.type == 5)
+        {
+            na["type"] = "MmapFileLogAppender";
+            na["file"] = a.file;
+            na["window"] = a.window;
+        }
+        else if (a.type == 6)
+        {
+            na["type"] = "BinaryLogAppender";
+            na["file"] = a.file;
+        }
+        else if (a.type == 7)
+        {
+            na["type"] = "ShmLogAppender";
+            na["name"] = a.file;
+            na["size"] = a.shm_size;
+        }
+        else if (a.type == 8)
+        {
+            na["type"] = "SocketLogAppender";
+            na["path"] = a.file;
+            na["socket"] = a.stream ? "stream" : "dgram";
+            na["spool"] = a.spool_size;
+            na["syslog"] = a.syslog;
+        }
+        else if (a.type == 3)
+        {
+            na["type"] = "AsyncLogAppender";
+            na["capacity"] = a.capacity;
+            na["overflow"] = AsyncLogAppender::ToString(a.overflow);
+            for (auto &i : a.appenders)
+            {
+                na["appenders"].push_back(AppenderDefineToYaml(i));
+            }
+        }
+        if ((a.type == 1 || a.type == 2) && a.batch_size)
+        {
+            na["batch_size"] = a.batch_size;
+            na["batch_latency"] = a.batch_latency;
+            na["flush_level"] = LogLevel::ToString(a.flush_level);
+        }
+        if (a.type == 1 && a.durable)
+        {
+            na["durable"] = true;
+            na["commit_interval"] = a.commit_interval;
+            na["commit_batch"] = a.commit_batch;
+            na["durable_wait"] = a.durable_wait;
+        }
+        if (a.level != LogLevel::UNKOWN)
+        {
+            na["level"] = LogLevel::ToString(a.level);
+        }
+
+        if (!a.formatter.empty())
+        {
+            na["formatter"] = a.formatter;
+        }
+        return na;
+    }
+
     template <>
     class LexicalCast<std::string, std::set<LogDefine>>
     {
@@ -726,44 +5131,25 @@ namespace sake
                 {
                     ld.formatter = n["formatter"].as<std::string>();
                 }
+                if (n["recorder_size"].IsDefined())
+                {
+                    ld.recorder_size = n["recorder_size"].as<size_t>();
+                }
+                if (n["recorder_level"].IsDefined())
+                {
+                    ld.recorder_level = LogLevel::FromString(n["recorder_level"].as<std::string>());
+                }
+                if (n["dedup_window"].IsDefined())
+                {
+                    ld.dedup_window = n["dedup_window"].as<uint32_t>();
+                }
+                if (n["dedup_slots"].IsDefined())
+                {
+                    ld.dedup_slots = n["dedup_slots"].as<size_t>();
+                }
                 if (n["appenders"].IsDefined())
                 {
-                    for (size_t j = 0; j < n["appenders"].size(); ++j)
-                    {
-                        auto a = n["appenders"][j];
-
-                        if (!a["type"].IsDefined())
-                        {
-                            std::cout << "log conf error : appeners type is null" << n << std::endl;
-                            continue;
-                        }
-                        std::string type = a["type"].as<std::string>();
-                        LogAppenderDefine lad;
-                        if (type == "FileLogAppender")
-                        {
-                            lad.type = 1;
-                            if (!a["file"].IsDefined())
-                            {
-                                std::cout << "log conf error : fileappener file is invalid" << a << std::endl;
-                                continue;
-                            }
-                            lad.file = a["file"].as<std::string>();
-                            if (a["formatter"].IsDefined())
-                            {
-                                lad.formatter = a["formatter"].as<std::string>();
-                            }
-                        }
-                        else if ("StdoutLogAppender")
-                        {
-                            lad.type = 2;
-                        }
-                        else
-                        {
-                            std::cout << "log conf error : appeners type is invalid" << n << std::endl;
-                            continue;
-                        }
-                        ld.appenders.push_back(lad);
-                    }
+                    ParseAppenderDefines(n["appenders"], ld.appenders);
                 }
                 s.insert(ld);
             }
@@ -790,28 +5176,19 @@ namespace sake
                 {
                     n["formatter"] = i.formatter;
                 }
+                if (i.recorder_size)
+                {
+                    n["recorder_size"] = i.recorder_size;
+                    n["recorder_level"] = LogLevel::ToString(i.recorder_level);
+                }
+                if (i.dedup_window)
+                {
+                    n["dedup_window"] = i.dedup_window;
+                    n["dedup_slots"] = i.dedup_slots;
+                }
                 for (auto &a : i.appenders)
                 {
-                    YAML::Node na;
-                    if (a.type == 1)
-                    {
-                        na["type"] = "FileLogAppender";
-                        na["file"] = a.file;
-                    }
-                    else if (a.type == 2)
-                    {
-                        na["type"] = "StdoutLogAppender";
-                    }
-                    if (a.level != LogLevel::UNKOWN)
-                    {
-                        na["level"] = LogLevel::ToString(a.level);
-                    }
-
-                    if (!a.formatter.empty())
-                    {
-                        na["formatter"] = a.formatter;
-                    }
-                    n["appenders"].push_back(na);
+                    n["appenders"].push_back(AppenderDefineToYaml(a));
                 }
                 node.push_back(n);
             }
@@ -821,6 +5198,69 @@ namespace sake
         }
     };
 
+    // 根据配置创建appender
+    static LogAppender::ptr CreateAppender(const std::string &logger_name, const LogAppenderDefine &j)
+    {
+        sake::LogAppender::ptr ap;
+        if (j.type == 1)
+        {
+            FileLogAppender::ptr file(new FileLogAppender(j.file));
+            file->setBatch(j.batch_size, j.batch_latency, j.flush_level);
+            file->setDurable(j.durable, j.commit_interval, j.commit_batch, j.durable_wait);
+            ap = file;
+        }
+        else if (j.type == 2)
+        {
+            StdoutLogAppender::ptr out(new StdoutLogAppender);
+            out->setBatch(j.batch_size, j.batch_latency, j.flush_level);
+            ap = out;
+        }
+        else if (j.type == 4)
+        {
+            ap.reset(new RollingFileLogAppender(j.file, j.max_size, j.interval, j.max_files, j.preallocate));
+        }
+        else if (j.type == 5)
+        {
+            ap.reset(new MmapFileLogAppender(j.file, j.window));
+        }
+        else if (j.type == 6)
+        {
+            ap.reset(new BinaryLogAppender(j.file));
+        }
+        else if (j.type == 7)
+        {
+            ap.reset(new ShmLogAppender(j.file, j.shm_size));
+        }
+        else if (j.type == 8)
+        {
+            ap.reset(new SocketLogAppender(j.file, j.stream, j.spool_size, j.syslog));
+        }
+        else if (j.type == 3)
+        {
+            AsyncLogAppender::ptr async(new AsyncLogAppender(j.capacity, j.overflow));
+            for (auto &k : j.appenders)
+            {
+                async->addAppender(CreateAppender(logger_name, k));
+            }
+            ap = async;
+        }
+        ap->setLevel(j.level);
+        if (!j.formatter.empty())
+        {
+            LogFormatter::ptr fmt(new LogFormatter(j.formatter));
+            if (!fmt->isError())
+            {
+                ap->setFormater(fmt);
+            }
+            else
+            {
+                std::cout << "log.name = " << logger_name << "appender formatter type = " << j.type
+                          << " formatter = " << j.formatter << " is invalid" << std::endl;
+            }
+        }
+        return ap;
+    }
+
     sake::ConfigVar<std::set<LogDefine>>::ptr g_log_defines = sake::Config::Lookup("logs", std::set<LogDefine>(), "logs config");
     struct LogIniter
     {
@@ -846,43 +5286,34 @@ namespace sake
                             logger = SAKE_LOG_NAME(i.name);
                         }
                     }
+                    if(!logger){
+                        //未变化的logger
+                        continue;
+                    }
                     logger->setLevel(i.level);
+                    logger->setRecorder(i.recorder_size, i.recorder_level);
+                    logger->setDedup(i.dedup_window, i.dedup_slots);
                     if(!i.formatter.empty()){
                         logger->setLogFormatter(i.formatter);
                     }
-                    logger->clearAppenders();
+                    //新的appender全部创建好再一次替换，正在输出的线程继续使用旧快照
+                    sake::Logger::AppenderList appenders;
                     for (auto &j : i.appenders)
                     {
-                        sake::LogAppender::ptr ap;
-                        if (j.type == 1)
-                        {
-                            ap.reset(new FileLogAppender(j.file));
-                        }
-                        else if(j.type == 2){
-                            ap.reset(new StdoutLogAppender);
-                        }
-                        ap->setLevel(j.level);
-                        if(!j.formatter.empty()){
-                            LogFormatter::ptr fmt(new LogFormatter(j.formatter));
-                            if(!fmt->isError()){
-                                ap->setFormater(fmt);
-                            }
-                            else{
-                                std::cout <<"log.name = " << i.name << "appender formatter type = " << j.type
-                                          << " formatter = " << j.formatter << " is invalid" << std::endl;
-                            }
-                        }
-                        logger->addAppender(ap);
+                        appenders.push_back(CreateAppender(i.name, j));
                     }
+                    logger->setAppenders(appenders);
                 }
 
                 //删除
                 for (auto &i : old_value){
                     auto it = new_value.find(i);
                     if(it == new_value.end()){
-                        //删除logger(不是真的删除，因为有static初始化,所以设置日志级别高)
+                        //删除logger(不是真的删除，因为有static初始化)，恢复继承父节点
                         auto logger = SAKE_LOG_NAME(i.name);
-                        logger->setLevel((LogLevel::Level)100);
+                        logger->setLevel(i.name == "root" ? LogLevel::DEBUG : LogLevel::UNKOWN);
+                        logger->setRecorder(0);
+                        logger->setDedup(0);
                         logger->clearAppenders();
                     }
                 } });
@@ -891,9 +5322,16 @@ namespace sake
     static LogIniter __log__init;
     std::string LoggerManager::toYamlString()
     {
-        MutexType::Lock lock(m_mutex);
+        // 哈希表的遍历顺序不固定，按名字排序后输出
+        std::vector<std::pair<std::string, Logger::ptr>> sorted;
+        {
+            SnapshotPtr<LoggerMap>::ReadGuard loggers(m_loggers);
+            sorted.assign(loggers->begin(), loggers->end());
+        }
+        std::sort(sorted.begin(), sorted.end(), [](const std::pair<std::string, Logger::ptr> &a, const std::pair<std::string, Logger::ptr> &b)
+                  { return a.first < b.first; });
         YAML::Node node;
-        for (auto &i : m_loggers)
+        for (auto &i : sorted)
         {
             node.push_back(YAML::Load(i.second->toYamlString()));
         }
@@ -14,16 +14,40 @@
 #include <time.h>
 #include <string.h>
 #include <map>
+#include <unordered_map>
 #include <thread>
 #include <pthread.h>
 #include <stdarg.h>
+#include <atomic>
+#include <type_traits>
+#include <sys/types.h>
+#include <sys/uio.h>
 #include "singleton.h"
 #include "util.h"
 #include "thread.h"
 
-#define SAKE_LOG_LEVEL(logger, level) \
-    if (logger->getLevel() <= level)  \
-    sake::LogEventWrap(sake::LogEvent::ptr(new sake::LogEvent(logger, level, __FILE__, __LINE__, 0, sake::util::GetThreadId(), sake::util::GetFiberId(), time(0), sake::Thread::GetName()))).getSS()
+// 编译期日志级别下限，低于该级别的语句整条编译掉(参数也不会求值)
+// 取值同LogLevel::Level，0表示不裁剪，构建时由CMake的SAKE_LOG_COMPILE_LEVEL选项设置
+#ifndef SAKE_LOG_COMPILE_LEVEL
+#define SAKE_LOG_COMPILE_LEVEL 0
+#endif
+
+#define SAKE_LOG_ENABLED(logger, level) \
+    ((level) >= SAKE_LOG_COMPILE_LEVEL && logger->getEffectiveLevel() <= (level))
+
+#define SAKE_LOG_STR_(x) #x
+#define SAKE_LOG_STR(x) SAKE_LOG_STR_(x)
+
+// 调用点元数据，用GNU语句表达式在展开处定义常量初始化的静态对象，没有构造开销
+// 调用点被LogSite::SetEnabled关闭时得到nullptr
+#define SAKE_LOG_SITE(level) __extension__({                                                               \
+    static sake::LogSite s_sake_log_site(__FILE__, __LINE__, SAKE_LOG_STR(__LINE__), __func__, level); \
+    s_sake_log_site.isOn() ? &s_sake_log_site : nullptr; })
+
+#define SAKE_LOG_LEVEL(logger, level)                                   \
+    if (SAKE_LOG_ENABLED(logger, level))                                \
+    if (const sake::LogSite *sake_log_site_ = SAKE_LOG_SITE(level))     \
+    sake::LogEventWrap(logger, level, sake_log_site_).getSS()
 
 #define SAKE_LOG_DEBUG(logger) SAKE_LOG_LEVEL(logger, sake::LogLevel::Level::DEBUG)
 #define SAKE_LOG_INFO(logger) SAKE_LOG_LEVEL(logger, sake::LogLevel::Level::INFO)
@@ -31,12 +55,20 @@
 #define SAKE_LOG_ERROR(logger) SAKE_LOG_LEVEL(logger, sake::LogLevel::Level::ERROR)
 #define SAKE_LOG_FATAL(logger) SAKE_LOG_LEVEL(logger, sake::LogLevel::Level::FATAL)
 
-#define SAKE_LOG_FMT_LEVEL(logger, level, fmt, ...)                                                                                        \
-    if (logger->getLevel() <= level)                                                                                                       \
-    sake::LogEventWrap(sake::LogEvent::ptr(new sake::LogEvent(logger, level, __FILE__, __LINE__, 0,                                        \
-                                                              sake::GetThreadId(), sake::GetFiberId(), time(0), sake::Thread::GetName()))) \
-        .getEvent()                                                                                                                        \
-        ->format(fmt, __VA_ARGS__)
+// 格式串和参数的编译期检查：LogFormatWrite是变参模板，无法直接带format属性
+// 三目运算的另一侧从不执行，只让编译器按printf规则检查，不匹配时在-Werror下编译失败
+#define SAKE_LOG_FMT_CHECK(fmt, ...) (false ? sake::LogFormatCheck(fmt, __VA_ARGS__) : (void)0)
+
+// 日志器只挂了BinaryLogAppender时，只记录调用点编号和原始参数，由sake_logdecode离线格式化
+// 调用点在第一次走二进制路径时登记格式串，之后格式串指针变了的调用退回文本路径
+#define SAKE_LOG_FMT_LEVEL(logger, level, fmt, ...)                                              \
+    if (SAKE_LOG_ENABLED(logger, level))                                                         \
+    if (const sake::LogSite *sake_log_site_ = SAKE_LOG_SITE(level))                              \
+    sake::LogFormatWrite(                                                                        \
+        logger, level, sake_log_site_, [&]() -> const sake::LogFormatSite & {                   \
+            static const sake::LogFormatSite s_site(sake_log_site_, level, fmt);                 \
+            return s_site; },                                                                    \
+        (SAKE_LOG_FMT_CHECK(fmt, __VA_ARGS__), fmt), __VA_ARGS__)
 
 #define SAKE_LOG_FMT_DEBUG(logger, fmt, ...) SAKE_LOG_FMT_LEVEL(logger, sake::LogLevel::Level::DEBUG, fmt, __VA_ARGS__)
 #define SAKE_LOG_FMT_INFO(logger, fmt, ...) SAKE_LOG_FMT_LEVEL(logger, sake::LogLevel::Level::INFO, fmt, __VA_ARGS__)
@@ -44,8 +76,43 @@
 #define SAKE_LOG_FMT_ERROR(logger, fmt, ...) SAKE_LOG_FMT_LEVEL(logger, sake::LogLevel::Level::ERROR, fmt, __VA_ARGS__)
 #define SAKE_LOG_FMT_FATAL(logger, fmt, ...) SAKE_LOG_FMT_LEVEL(logger, sake::LogLevel::Level::FATAL, fmt, __VA_ARGS__)
 
+// 类型安全的格式化，按{}占位符依次用operator<<输出参数，不解析可变参数
+#define SAKE_LOG_PRINT_LEVEL(logger, level, fmt, ...)               \
+    if (SAKE_LOG_ENABLED(logger, level))                             \
+    if (const sake::LogSite *sake_log_site_ = SAKE_LOG_SITE(level))  \
+    sake::LogEventWrap(logger, level, sake_log_site_).getEvent()->print(fmt, __VA_ARGS__)
+
+#define SAKE_LOG_PRINT_DEBUG(logger, fmt, ...) SAKE_LOG_PRINT_LEVEL(logger, sake::LogLevel::Level::DEBUG, fmt, __VA_ARGS__)
+#define SAKE_LOG_PRINT_INFO(logger, fmt, ...) SAKE_LOG_PRINT_LEVEL(logger, sake::LogLevel::Level::INFO, fmt, __VA_ARGS__)
+#define SAKE_LOG_PRINT_WARN(logger, fmt, ...) SAKE_LOG_PRINT_LEVEL(logger, sake::LogLevel::Level::WARN, fmt, __VA_ARGS__)
+#define SAKE_LOG_PRINT_ERROR(logger, fmt, ...) SAKE_LOG_PRINT_LEVEL(logger, sake::LogLevel::Level::ERROR, fmt, __VA_ARGS__)
+#define SAKE_LOG_PRINT_FATAL(logger, fmt, ...) SAKE_LOG_PRINT_LEVEL(logger, sake::LogLevel::Level::FATAL, fmt, __VA_ARGS__)
+
+// 调用点限流，被拒绝的日志在构造LogEvent之前就丢弃
+// 限流参数只在调用点第一次执行时读取；之后放行的那条日志带上期间被丢弃的条数
+#define SAKE_LOG_LIMITED(logger, level, limiter)                                        \
+    if (SAKE_LOG_ENABLED(logger, level))                                                 \
+    if (const sake::LogSite *sake_log_site_ = SAKE_LOG_SITE(level))                      \
+    if (sake::LogLimitPass sake_log_pass_ = [&]() -> decltype(limiter) & {              \
+            static decltype(limiter) s_limiter = limiter;                               \
+            return s_limiter; }().tryPass())                                            \
+    sake::LogEventWrap(logger, level, sake_log_site_).getSS() << sake_log_pass_
+
+// 每n条记录一条
+#define SAKE_LOG_EVERY_N(logger, level, n) SAKE_LOG_LIMITED(logger, level, sake::LogEveryN(n))
+// 只记录前n条
+#define SAKE_LOG_FIRST_N(logger, level, n) SAKE_LOG_LIMITED(logger, level, sake::LogFirstN(n))
+// 每ms毫秒最多记录一条
+#define SAKE_LOG_EVERY_MS(logger, level, ms) SAKE_LOG_LIMITED(logger, level, sake::LogEveryMs(ms))
+// 令牌桶，每秒补充rate条，最多攒burst条
+#define SAKE_LOG_RATE_LIMIT(logger, level, rate, burst) SAKE_LOG_LIMITED(logger, level, sake::LogRateLimit(rate, burst))
+
 #define SAKE_LOG_ROOT() sake::LoggerMgr::GetInstance()->getRoot()
 #define SAKE_LOG_NAME(name) sake::LoggerMgr::GetInstance()->getLogger(name)
+// 每个调用点只查找一次日志器，name须为常量；日志器创建后不会被删除，缓存一直有效
+#define SAKE_LOG_NAME_CACHED(name) ([]() -> const sake::Logger::ptr & {          \
+    static const sake::Logger::ptr s_logger = sake::LoggerMgr::GetInstance()->getLogger(name); \
+    return s_logger; }())
 
 namespace sake
 {
@@ -53,9 +120,9 @@ namespace sake
     class LogEvent;
     class LogAppender;
     class LogFormatter;
-    class FormatItem;
     class StdoutLogAppender;
     class FileLogAppender;
+    class BinaryLogAppender;
     class LogLevel;
     // 日志级别
     class LogLevel
@@ -75,49 +142,391 @@ namespace sake
         static LogLevel::Level FromString(const std::string &str);
     };
 
+    // 日志调用点，SAKE_LOG_*展开处的静态对象，事件只保存指向它的指针
+    // 文件名、行号文本在编译期确定，格式化时直接拷贝
+    struct LogSite
+    {
+        enum State : int8_t
+        {
+            STATE_OFF = -1,
+            STATE_NEW = 0, // 还没执行过，第一次执行时登记
+            STATE_ON = 1
+        };
+
+        constexpr LogSite(const char *file_, int32_t line_, const char *line_str, const char *func_, LogLevel::Level level_)
+            : file(file_), baseName(BaseName(file_, file_)), lineStr(line_str), func(func_), line(line_), level(level_), state(STATE_NEW) {}
+
+        // 开着时和关闭时都只有一次relaxed load
+        bool isOn()
+        {
+            int8_t s = state.load(std::memory_order_relaxed);
+            return s > 0 || (s == STATE_NEW && Register(this));
+        }
+
+        // 按"文件"或"文件:行号"开关调用点，文件匹配路径结尾(如 log.cpp、src/log.cpp)
+        // 对之后才第一次执行的调用点同样生效，返回当前已登记且匹配的调用点个数
+        static size_t SetEnabled(const std::string &spec, bool on);
+        // 已执行过的调用点
+        static std::vector<const LogSite *> GetSites();
+        // 不经过SAKE_LOG_*宏的事件按文件和行号共用一份，不参与开关
+        static const LogSite *Intern(const char *file, int32_t line);
+        // 默认构造的事件使用的空调用点
+        static const LogSite *Unknown();
+
+        static constexpr const char *BaseName(const char *p, const char *base)
+        {
+            return *p == '\0' ? base : BaseName(p + 1, *p == '/' ? p + 1 : base);
+        }
+
+        const char *file;
+        const char *baseName;
+        const char *lineStr;
+        const char *func;
+        int32_t line;
+        // 宏展开处的级别，事件的级别以LogEvent::getLevel为准
+        LogLevel::Level level;
+        std::atomic<int8_t> state;
+
+    private:
+        static bool Register(LogSite *site);
+    };
+
+    // 映射诊断上下文(MDC)：当前协程的一组键值，不在协程里时用当前线程的，由%X{key}输出
+    // 定长内联存储，压入、弹出O(1)且不分配内存；超长的键值截断，满了之后压入失败
+    // 平凡类型，零初始化即为空；Fiber::swapIn/swapOut切换当前上下文，事件创建时拷贝一份
+    class LogMdc
+    {
+    public:
+        static const size_t MAX_ENTRIES = 8;
+        static const size_t MAX_KEY = 22;
+        static const size_t MAX_VALUE = 40;
+
+        struct Entry
+        {
+            uint8_t keyLen;
+            uint8_t valueLen;
+            char key[MAX_KEY];
+            char value[MAX_VALUE];
+        };
+
+        // 已满时返回false
+        bool push(const char *key, size_t key_len, const char *value, size_t value_len);
+        bool push(const std::string &key, const std::string &value) { return push(key.data(), key.size(), value.data(), value.size()); }
+        // 弹出最近压入的一项
+        void pop()
+        {
+            if (m_size)
+            {
+                --m_size;
+            }
+        }
+        void clear() { m_size = 0; }
+        // 同名的键取最近压入的，没有时返回nullptr
+        const Entry *find(const char *key, size_t len) const;
+        size_t size() const { return m_size; }
+        const Entry &get(size_t i) const { return m_entries[i]; }
+        // 只拷贝用到的项
+        void assign(const LogMdc &oth);
+
+        // 当前协程的上下文，不在协程里时为当前线程的
+        static LogMdc *Current();
+        // 协程切换时调用，nullptr表示回到线程的上下文
+        static void SetCurrent(LogMdc *mdc);
+        // 没有任何项的上下文
+        static const LogMdc &Empty();
+
+    private:
+        uint32_t m_size;
+        Entry m_entries[MAX_ENTRIES];
+    };
+
+    // 作用域内在当前上下文压入一项，离开时弹出
+    class LogMdcGuard
+    {
+    public:
+        LogMdcGuard(const std::string &key, const std::string &value)
+            : m_mdc(LogMdc::Current()), m_pushed(m_mdc->push(key, value)) {}
+        LogMdcGuard(const char *key, const char *value)
+            : m_mdc(LogMdc::Current()), m_pushed(m_mdc->push(key, strlen(key), value, strlen(value))) {}
+        ~LogMdcGuard()
+        {
+            if (m_pushed)
+            {
+                m_mdc->pop();
+            }
+        }
+
+    private:
+        LogMdcGuard(const LogMdcGuard &) = delete;
+        LogMdcGuard &operator=(const LogMdcGuard &) = delete;
+
+    private:
+        LogMdc *m_mdc;
+        bool m_pushed;
+    };
+
+    // 日志消息缓冲，先写内联数组，写满后转到可复用的堆缓冲
+    class LogStreamBuf : public std::streambuf
+    {
+    public:
+        LogStreamBuf();
+
+        const char *data() const { return pbase(); }
+        size_t size() const { return pptr() - pbase(); }
+        // 清空内容，保留已分配的容量
+        void reset();
+        // 直接写入缓冲：prepare保证至少n字节可写并返回写入位置，写完后commit实际长度
+        size_t available() const { return epptr() - pptr(); }
+        char *prepare(size_t n)
+        {
+            if (available() < n)
+            {
+                grow(n);
+            }
+            return pptr();
+        }
+        void commit(size_t n) { pbump(n); }
+
+    protected:
+        int_type overflow(int_type c) override;
+        std::streamsize xsputn(const char *s, std::streamsize n) override;
+
+    private:
+        void grow(size_t need);
+
+    private:
+        char m_inline[256];
+        std::string m_spill;
+    };
+
+    // 事件自带的消息流，随事件一起池化复用
+    class LogStream : public std::ostream
+    {
+    public:
+        LogStream(LogEvent *event = nullptr);
+
+        const char *data() const { return m_buf.data(); }
+        size_t size() const { return m_buf.size(); }
+        // 清空内容并恢复默认格式状态
+        void reset();
+        // 所属事件，sake::KV据此把字段挂到事件上
+        LogEvent *getEvent() const { return m_event; }
+        LogStreamBuf &getBuf() { return m_buf; }
+
+    private:
+        LogStreamBuf m_buf;
+        LogEvent *m_event;
+    };
+
     // 日志事件
     class LogEvent
     {
     public:
         typedef std::shared_ptr<LogEvent> ptr;
+        // 结构化字段类型
+        enum FieldType : uint8_t
+        {
+            FIELD_INT = 1,
+            FIELD_UINT = 2,
+            FIELD_DOUBLE = 3,
+            FIELD_BOOL = 4,
+            FIELD_STRING = 5
+        };
+        // 键和字符串值拷贝在事件的字段缓冲里，用偏移引用
+        struct Field
+        {
+            uint8_t type;
+            uint16_t keyLen;
+            uint32_t keyOffset;
+            union
+            {
+                int64_t i;
+                uint64_t u;
+                double d;
+                struct
+                {
+                    uint32_t offset;
+                    uint32_t len;
+                } s;
+            };
+        };
+        // 单条事件的字段上限，超出的字段丢弃
+        static const size_t MAX_FIELDS = 16;
+
+        LogEvent();
+        // time为秒，需要微秒精度时用reset
         LogEvent(std::shared_ptr<Logger> logger, LogLevel::Level level, const char *file, int32_t line, uint64_t elapse, uint32_t thread_id, uint32_t fiber_id, uint64_t time, const std::string &thread_name);
 
-        const char *getFile() const { return m_file; }
-        int32_t getLine() const { return m_line; }
+        // 复用事件时重新填充字段，消息清空；time_us为微秒
+        void reset(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogSite *site, uint64_t elapse, uint32_t thread_id, uint32_t fiber_id, uint64_t time_us, const std::string &thread_name);
+        void reset(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const char *file, int32_t line, uint64_t elapse, uint32_t thread_id, uint32_t fiber_id, uint64_t time_us, const std::string &thread_name)
+        {
+            reset(logger, level, LogSite::Intern(file, line), elapse, thread_id, fiber_id, time_us, thread_name);
+        }
+
+        const LogSite *getSite() const { return m_site; }
+        const char *getFile() const { return m_site->file; }
+        const char *getBaseName() const { return m_site->baseName; }
+        const char *getFunction() const { return m_site->func; }
+        int32_t getLine() const { return m_site->line; }
         uint32_t getThreadId() const { return m_threadId; }
         uint32_t getFiberId() const { return m_fiberId; }
         uint64_t getElapse() const { return m_elapse; }
-        uint64_t getTime() const { return m_time; }
-        std::string getContent() const { return m_ss.str(); }
-        std::stringstream &getSS() { return m_ss; }
+        // 秒级时间
+        uint64_t getTime() const { return m_time / 1000000; }
+        // 微秒级时间
+        uint64_t getTimeUs() const { return m_time; }
+        std::string getContent() const { return std::string(m_ss.data(), m_ss.size()); }
+        const char *getContentData() const { return m_ss.data(); }
+        size_t getContentSize() const { return m_ss.size(); }
+        std::ostream &getSS() { return m_ss; }
         const std::string &getThreadName() const { return m_threadName; }
-        std::shared_ptr<Logger> getLogger() { return m_logger; }
-        LogLevel::Level getLevel() { return m_level; }
+        // 事件持有日志器，异步队列或飞行记录里的事件比日志器活得久时仍可访问
+        const std::shared_ptr<Logger> &getLogger() const { return m_logger; }
+        void setLogger(const std::shared_ptr<Logger> &logger) { m_logger = logger; }
+        LogLevel::Level getLevel() const { return m_level; }
+
+        // 复制另一个事件的全部内容，复用自己已分配的缓冲
+        void assign(const LogEvent &oth);
 
-        void format(const char *fmt, ...);
-        void format(const char *fmt, va_list al);
+        // printf格式化，直接写入消息缓冲
+        void format(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+        void format(const char *fmt, va_list al) __attribute__((format(printf, 2, 0)));
+        // 按{}占位符依次输出参数，参数用operator<<输出，{{和}}输出花括号
+        // 占位符多于参数时原样保留，参数多于占位符时忽略多余的参数
+        template <class... Args>
+        void print(const char *fmt, const Args &...args)
+        {
+            printArgs(fmt, args...);
+        }
+
+        // 附加结构化字段，由%J/%K输出
+        template <class T>
+        typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type addField(const char *key, T v)
+        {
+            Field *field = newField(key);
+            if (!field)
+            {
+                return;
+            }
+            if ((T)-1 < (T)0)
+            {
+                field->type = FIELD_INT;
+                field->i = (int64_t)v;
+            }
+            else
+            {
+                field->type = FIELD_UINT;
+                field->u = (uint64_t)v;
+            }
+        }
+        void addField(const char *key, bool v);
+        void addField(const char *key, double v);
+        void addField(const char *key, const char *v) { addField(key, v, strlen(v)); }
+        void addField(const char *key, const std::string &v) { addField(key, v.data(), v.size()); }
+        void addField(const char *key, const char *v, size_t len);
+
+        size_t getFieldCount() const { return m_fieldCount; }
+        const Field &getField(size_t i) const { return m_fields[i]; }
+        const char *getFieldKey(const Field &field) const { return m_fieldData.data() + field.keyOffset; }
+        const char *getFieldString(const Field &field) const { return m_fieldData.data() + field.s.offset; }
+
+        // 事件创建时的诊断上下文
+        const LogMdc &getMdc() const { return m_mdc ? *m_mdc : LogMdc::Empty(); }
+        // 替换创建时拷贝的上下文，用于还原别处记录的事件
+        void setMdc(const LogMdc &mdc);
+
+    private:
+        // 输出fmt中下一个占位符之前的文本，返回占位符之后的位置，没有占位符时返回nullptr
+        const char *printText(const char *fmt);
+        void printArgs(const char *fmt)
+        {
+            while (fmt)
+            {
+                fmt = printText(fmt);
+                if (fmt)
+                {
+                    m_ss.write("{}", 2);
+                }
+            }
+        }
+        template <class T, class... Args>
+        void printArgs(const char *fmt, const T &v, const Args &...args)
+        {
+            fmt = printText(fmt);
+            if (fmt)
+            {
+                m_ss << v;
+                printArgs(fmt, args...);
+            }
+        }
+
+        Field *newField(const char *key);
 
     private:
-        // 文件名称
-        const char *m_file = nullptr;
-        // 行号
-        int32_t m_line = 0;
+        // 调用点(文件、行号、函数)
+        const LogSite *m_site = LogSite::Unknown();
         // 程序启动到现在的毫秒数
         uint64_t m_elapse = 0;
         // 线程Id
         uint32_t m_threadId = 0;
         // 协程Id
         uint32_t m_fiberId = 0;
-        // 时间
+        // 时间(微秒)
         uint64_t m_time = 0;
         // 线程名称
         std::string m_threadName;
         // 消息
-        std::stringstream m_ss;
-        // 日志器
+        LogStream m_ss{this};
+        // 日志器，池化的事件复用时同一个日志器不重复计数
         std::shared_ptr<Logger> m_logger;
         // 日志级别
-        LogLevel::Level m_level;
+        LogLevel::Level m_level = LogLevel::UNKOWN;
+        // 结构化字段，第一次添加时分配MAX_FIELDS个，键和字符串值存在可复用的m_fieldData里
+        std::unique_ptr<Field[]> m_fields;
+        uint8_t m_fieldCount = 0;
+        std::string m_fieldData;
+        // 诊断上下文的拷贝，异步输出时当前协程已经变了；上下文非空时才分配
+        // 两者都随池化的事件保留，不常用的部分不占事件本身的大小
+        std::unique_ptr<LogMdc> m_mdc;
+    };
+
+    // 流式写法里附加结构化字段：SAKE_LOG_INFO(g_logger) << sake::KV("uid", uid) << "login"
+    template <class T>
+    struct LogKV
+    {
+        const char *key;
+        const T &value;
+    };
+
+    template <class T>
+    LogKV<T> KV(const char *key, const T &value)
+    {
+        return LogKV<T>{key, value};
+    }
+
+    // 不是日志事件的流时按key=value输出
+    template <class T>
+    std::ostream &operator<<(std::ostream &os, const LogKV<T> &kv)
+    {
+        LogStream *stream = dynamic_cast<LogStream *>(&os);
+        if (stream && stream->getEvent())
+        {
+            stream->getEvent()->addField(kv.key, kv.value);
+        }
+        else
+        {
+            os << kv.key << '=' << kv.value;
+        }
+        return os;
+    }
+
+    // 线程局部的事件池，只被池引用的事件可以复用
+    // 异步appender持有的事件在其释放引用后自动回到可用状态
+    class LogEventPool
+    {
+    public:
+        static LogEvent::ptr Acquire();
     };
 
     // logevent日志事件包装器
@@ -125,32 +534,175 @@ namespace sake
     {
     public:
         LogEventWrap(LogEvent::ptr e);
+        // 从线程事件池取事件并填充当前线程/协程/时间信息
+        LogEventWrap(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const LogSite *site);
+        LogEventWrap(const std::shared_ptr<Logger> &logger, LogLevel::Level level, const char *file, int32_t line);
         ~LogEventWrap();
-        std::stringstream &getSS();
-        LogEvent::ptr getEvent() const { return m_event; }
+        std::ostream &getSS();
+        const LogEvent::ptr &getEvent() const { return m_event; }
 
     private:
         LogEvent::ptr m_event;
     };
 
+    // 限流判定结果，放行时带上自上次放行以来被丢弃的条数
+    struct LogLimitPass
+    {
+        LogLimitPass(bool p, uint64_t s = 0) : pass(p), suppressed(s) {}
+        explicit operator bool() const { return pass; }
+
+        bool pass;
+        uint64_t suppressed;
+    };
+    // 有丢弃时在消息前输出 [suppressed N]
+    std::ostream &operator<<(std::ostream &os, const LogLimitPass &pass);
+
+    // 以下限流器每个调用点一份静态对象，只用原子操作，多线程同时判定不加锁
+    class LogEveryN
+    {
+    public:
+        LogEveryN(uint64_t n) : m_n(n ? n : 1) {}
+        LogEveryN(const LogEveryN &oth) : m_n(oth.m_n) {}
+
+        LogLimitPass tryPass()
+        {
+            uint64_t count = m_count.fetch_add(1, std::memory_order_relaxed);
+            if (count % m_n)
+            {
+                return LogLimitPass(false);
+            }
+            return LogLimitPass(true, count ? m_n - 1 : 0);
+        }
+
+    private:
+        uint64_t m_n;
+        std::atomic<uint64_t> m_count{0};
+    };
+
+    class LogFirstN
+    {
+    public:
+        LogFirstN(uint64_t n) : m_n(n) {}
+        LogFirstN(const LogFirstN &oth) : m_n(oth.m_n) {}
+
+        LogLimitPass tryPass()
+        {
+            // 额度用完后只读不写，热点调用点不再争抢缓存行
+            if (m_count.load(std::memory_order_relaxed) >= m_n)
+            {
+                return LogLimitPass(false);
+            }
+            return LogLimitPass(m_count.fetch_add(1, std::memory_order_relaxed) < m_n);
+        }
+
+    private:
+        uint64_t m_n;
+        std::atomic<uint64_t> m_count{0};
+    };
+
+    class LogEveryMs
+    {
+    public:
+        LogEveryMs(uint64_t ms) : m_interval(ms * 1000) {}
+        LogEveryMs(const LogEveryMs &oth) : m_interval(oth.m_interval) {}
+
+        LogLimitPass tryPass();
+
+    private:
+        uint64_t m_interval;
+        // 下次允许记录的时间(单调时钟，微秒)
+        std::atomic<uint64_t> m_next{0};
+        std::atomic<uint64_t> m_suppressed{0};
+    };
+
+    // 令牌桶，用GCRA实现：只保存一个理论到达时间，一次CAS完成取令牌
+    class LogRateLimit
+    {
+    public:
+        LogRateLimit(double rate, uint64_t burst);
+        LogRateLimit(const LogRateLimit &oth) : m_interval(oth.m_interval), m_tolerance(oth.m_tolerance) {}
+
+        LogLimitPass tryPass();
+
+    private:
+        // 每个令牌的间隔(纳秒)
+        uint64_t m_interval;
+        // 允许提前的时间，burst个令牌
+        uint64_t m_tolerance;
+        std::atomic<uint64_t> m_tat{0};
+        std::atomic<uint64_t> m_suppressed{0};
+    };
+
+    // 重复日志去重：按调用点、级别和消息内容哈希，窗口内只放行第一条
+    // 窗口结束后由后台线程(约每10ms检查一次)汇报期间被去掉的条数
+    // 哈希表分片、开放寻址，占用、计数和释放都只用原子操作，日志线程之间不加锁
+    class LogDedup
+    {
+    public:
+        typedef std::shared_ptr<LogDedup> ptr;
+        // 汇报一个窗口内被去掉的条数，text为第一条的消息(过长时截断)
+        typedef std::function<void(LogLevel::Level level, const LogSite *site, uint64_t repeats, const char *text, size_t len)> Reporter;
+
+        // window_ms 窗口长度
+        // slots     同时跟踪的不同消息数，按分片向上取整到2的幂；表满时新消息不去重
+        LogDedup(uint32_t window_ms, size_t slots, Reporter reporter);
+        // 汇报所有未结束的窗口
+        ~LogDedup();
+
+        // 返回false表示窗口内的重复日志，应丢弃
+        bool check(LogLevel::Level level, const LogEvent &event);
+        // 汇报并释放已结束的窗口，all为true时不论是否到期
+        void sweep(bool all = false);
+
+        uint32_t getWindow() const { return m_window / 1000; }
+        size_t getSlots() const { return m_shardSlots * SHARDS; }
+        // slots实际取整后的槽位数
+        static size_t RoundSlots(size_t slots);
+
+    private:
+        static const size_t SHARDS = 16;
+        // 每个键最多探测的槽位数
+        static const size_t PROBE = 8;
+        static const size_t TEXT_SIZE = 224;
+
+        // 按256字节填充，不同消息的计数不共享cache line
+        struct Slot
+        {
+            // 高32位为键的标签，低32位为窗口内重复的次数，0表示空槽
+            std::atomic<uint64_t> state{0};
+            // 窗口结束时间(单调时钟，微秒)，0表示占用者还没填好内容
+            std::atomic<uint64_t> expire{0};
+            const LogSite *site = nullptr;
+            LogLevel::Level level = LogLevel::UNKOWN;
+            uint32_t len = 0;
+            char text[TEXT_SIZE];
+        };
+
+        // 标签仍是tag时计一次重复，返回false表示槽位已换了别的键
+        static bool AddRepeat(Slot &slot, uint64_t state, uint64_t tag);
+
+    private:
+        // 窗口长度(微秒)
+        uint64_t m_window;
+        size_t m_shardSlots;
+        std::unique_ptr<Slot[]> m_shards[SHARDS];
+        Reporter m_reporter;
+        // 只串行化sweep，日志线程不用
+        Mutex m_sweepMutex;
+    };
+
     // 日志格式器
+    // init()把pattern编译成一段紧凑的指令序列，format时按序追加到调用方提供的缓冲
     class LogFormatter
     {
     public:
         typedef std::shared_ptr<LogFormatter> ptr;
         std::string format(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event);
+        // 格式化结果追加到buf末尾
+        void format(std::string &buf, LogLevel::Level level, const LogEvent &event) const;
         LogFormatter(const std::string &pattern);
 
     public:
-        // 日志解析模块
-        class FormatItem
-        {
-        public:
-            typedef std::shared_ptr<FormatItem> ptr;
-            virtual ~FormatItem() {}
-            virtual void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) = 0;
-        };
-
         // 解析pattern
         void init();
 
@@ -158,12 +710,71 @@ namespace sake
 
         const std::string getPattern() const { return m_pattern; }
 
+    private:
+        // 格式化指令
+        enum OpCode : uint8_t
+        {
+            OP_STRING,
+            OP_MESSAGE,
+            OP_LEVEL,
+            OP_ELAPSE,
+            OP_NAME,
+            OP_THREAD_ID,
+            OP_NEWLINE,
+            OP_DATETIME,
+            OP_FILENAME,
+            OP_LINE,
+            OP_TAB,
+            OP_FIBER_ID,
+            OP_THREAD_NAME,
+            OP_JSON,
+            OP_LOGFMT,
+            OP_BASENAME,
+            OP_FUNCTION,
+            OP_MDC
+        };
+
+        struct Op
+        {
+            uint8_t code = OP_STRING;
+            // 参数在m_literals中的位置
+            uint32_t offset = 0;
+            uint32_t length = 0;
+        };
+
+        // %d的时间格式，按秒缓存strftime结果，小数部分每次拼接
+        struct DateFormat
+        {
+            // 全局唯一，作为线程缓存的key
+            uint64_t id = 0;
+            std::string prefix;
+            // 小数位数，0/3/6
+            int digits = 0;
+            std::string suffix;
+        };
+
+        void addLiteral(OpCode code, const std::string &str);
+        void addDateFormat(OpCode code, const std::string &fmt);
+        void formatDate(std::string &buf, const DateFormat &date, uint64_t time_us) const;
+        // 整条事件输出为一个JSON对象，时间按date格式
+        void formatJson(std::string &buf, const DateFormat &date, LogLevel::Level level, const LogEvent &event) const;
+        // 只输出结构化字段，logfmt格式 key=value
+        void formatLogfmt(std::string &buf, const LogEvent &event) const;
+        // 诊断上下文中key的值，key为空时按key=value输出全部
+        void formatMdc(std::string &buf, const Op &op, const LogEvent &event) const;
+
     private:
         // 日志格式模板
         std::string m_pattern;
 
-        // 日志解析后的格式
-        std::vector<FormatItem::ptr> m_items;
+        // 日志解析后的指令
+        std::vector<Op> m_ops;
+
+        // 字面量
+        std::string m_literals;
+
+        // 时间格式
+        std::vector<DateFormat> m_dates;
 
         bool m_isError = false;
     };
@@ -177,16 +788,39 @@ namespace sake
         typedef std::shared_ptr<LogAppender> ptr;
         typedef SpinLock MutexType;
         virtual ~LogAppender() {}
-        virtual void log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) = 0;
+        // 默认实现：用自己的格式器格式化后交给append
+        virtual void log(Logger *logger, LogLevel::Level level, const LogEvent::ptr &event);
         virtual std::string toYamlString() = 0;
 
         void setFormater(LogFormatter::ptr formatter);
         LogFormatter::ptr getFormatter();
-        LogLevel::Level getLevel() const { return m_level; }
-        void setLevel(LogLevel::Level level) { m_level = level; }
+        // 日志器下发默认格式器，appender单独配置过格式器时不覆盖
+        virtual void setDefaultFormatter(LogFormatter::ptr formatter);
+        LogLevel::Level getLevel() const { return m_level.load(std::memory_order_relaxed); }
+        // 修改后通知所属日志器重新计算生效级别
+        void setLevel(LogLevel::Level level);
+        // 进程崩溃时由LogCrashHandler调用，写出缓冲中的日志
+        // 运行在信号处理函数中，只能用异步信号安全的调用，不能加锁、不能分配内存
+        virtual void flushOnCrash() {}
+
+    protected:
+        // 写入格式化好的日志
+        virtual void append(LogLevel::Level level, const LogEvent::ptr &event, const char *data, size_t len) {}
+        // 只通过append落地时返回true，日志器会让使用同一格式器的appender共享一次格式化结果
+        virtual bool isFormatShareable() const { return false; }
+
+    private:
+        void addOwner(Logger *logger);
+        void delOwner(Logger *logger);
+        // 级别、格式器变化后通知所属日志器
+        void notifyOwners();
 
     protected:
-        LogLevel::Level m_level = LogLevel::DEBUG;
+        // 配置重载时会被其他线程修改，用relaxed原子读写
+        std::atomic<LogLevel::Level> m_level{LogLevel::DEBUG};
+
+        // 引用该appender的日志器
+        std::vector<Logger *> m_owners;
 
         bool m_hasFormatter = false;
 
@@ -195,22 +829,29 @@ namespace sake
     };
 
     // 日志器
+    // 名称按"."分层，net.http.client的父节点是已存在的最近祖先(net.http、net，都没有时为root)
+    // 级别为UNKOWN时继承父节点，没有appender时使用父节点的appender集合
+    // 继承结果在配置变化时算好，只重算变化的日志器所在子树，输出时不再向上查找
     class Logger : public std::enable_shared_from_this<Logger>
     {
         friend class LoggerManager;
+        friend class LogAppender;
 
     public:
         typedef std::shared_ptr<Logger> ptr;
-        typedef SpinLock MutexType;
+        // 只串行化修改，写者发布快照时可能要等正在输出的读者，用互斥锁不用自旋锁
+        typedef Mutex MutexType;
+        typedef std::vector<LogAppender::ptr> AppenderList;
         Logger(const std::string name = "root");
+        ~Logger();
 
-        void log(LogLevel::Level level, LogEvent::ptr event);
+        void log(LogLevel::Level level, const LogEvent::ptr &event);
 
-        void debug(LogEvent::ptr event);
-        void info(LogEvent::ptr event);
-        void warn(LogEvent::ptr event);
-        void error(LogEvent::ptr event);
-        void fatal(LogEvent::ptr event);
+        void debug(const LogEvent::ptr &event);
+        void info(const LogEvent::ptr &event);
+        void warn(const LogEvent::ptr &event);
+        void error(const LogEvent::ptr &event);
+        void fatal(const LogEvent::ptr &event);
 
         // 添加日志落地目标
         void addAppender(LogAppender::ptr appender);
@@ -220,9 +861,44 @@ namespace sake
 
         void clearAppenders();
 
-        LogLevel::Level getLevel() const { return m_level; }
-        void setLevel(LogLevel::Level level) { m_level = level; }
+        // 整体替换落地目标，配置重载时一次发布，不会出现中间状态
+        void setAppenders(const AppenderList &appenders);
+
+        // 自己设置的级别，UNKOWN表示继承父节点
+        LogLevel::Level getLevel() const { return m_level.load(std::memory_order_relaxed); }
+        void setLevel(LogLevel::Level level);
+        // 宏判断用的生效级别：日志器级别和所有appender最低级别取较大者，开启飞行记录时不高于记录级别
+        LogLevel::Level getEffectiveLevel() const { return m_effectiveLevel.load(std::memory_order_relaxed); }
         const std::string &getName() const { return m_name; }
+        // 父节点，root和不经过LoggerManager创建的日志器没有父节点
+        Logger::ptr getParent() const { return m_parent; }
+        // 进程内唯一编号，二进制日志用它代替名称；第一次写二进制记录时才登记
+        uint32_t getId() const
+        {
+            uint32_t id = m_id.load(std::memory_order_acquire);
+            return id ? id : registerId();
+        }
+
+        // 所有appender都是BinaryLogAppender
+        bool isBinaryOnly() const { return m_binaryOnly.load(std::memory_order_relaxed); }
+        // 按二进制格式记录，快照已不是纯二进制时返回false，由调用方退回文本路径
+        template <class... Args>
+        bool logBinary(LogLevel::Level level, uint32_t site, const Args &...args);
+
+        // 飞行记录：低于输出级别、不低于record_level的事件不丢弃，原样存进当前线程size条的环形缓冲
+        // 本线程输出dump_level及以上的日志时，先把缓冲里的事件交给appender；size为0时关闭
+        void setRecorder(size_t size, LogLevel::Level record_level = LogLevel::DEBUG, LogLevel::Level dump_level = LogLevel::ERROR);
+        size_t getRecorderSize() const { return m_recordSize.load(std::memory_order_relaxed); }
+        LogLevel::Level getRecorderLevel() const { return m_recordLevel.load(std::memory_order_relaxed); }
+        LogLevel::Level getDumpLevel() const { return m_dumpLevel.load(std::memory_order_relaxed); }
+        // 把记录的事件按时间顺序交给appender(appender自己的级别仍然生效)
+        // all_threads为false时只处理当前线程
+        void dumpRecorder(bool all_threads = false);
+
+        // 重复日志去重：window_ms内调用点、级别和消息都相同的日志只输出第一条
+        // 窗口结束后补一条"[repeated N times] 消息"；window_ms为0时关闭
+        void setDedup(uint32_t window_ms, size_t slots = 4096);
+        uint32_t getDedupWindow() const { return m_dedupWindow.load(std::memory_order_relaxed); }
 
         void setLogFormatter(LogFormatter::ptr val);
         void setLogFormatter(const std::string &val);
@@ -231,32 +907,243 @@ namespace sake
 
         std::string toYamlString();
 
+    private:
+        // 使用同一格式器的appender，每条事件只格式化一次
+        struct FormatGroup
+        {
+            LogFormatter::ptr formatter;
+            std::vector<LogAppender *> appenders;
+        };
+
+        // appender集合快照，集合变化时预先算好分组和聚合值
+        struct AppenderSet
+        {
+            AppenderList appenders;
+            // 自己实现log的appender，事件原样转交
+            std::vector<LogAppender *> direct;
+            std::vector<FormatGroup> groups;
+            std::vector<BinaryLogAppender *> binary;
+            // 所有appender中的最低级别
+            LogLevel::Level minLevel = LogLevel::UNKOWN;
+        };
+
+        // 一个线程的飞行记录，只有所属线程写入
+        struct RecorderRing
+        {
+            SpinLock mutex;
+            std::vector<LogEvent::ptr> events;
+            size_t next = 0;
+            size_t count = 0;
+        };
+
+        // 交给appender，不再检查日志器级别
+        void dispatch(LogLevel::Level level, const LogEvent::ptr &event);
+        // size为调用方读到的缓冲大小，为0时不记录
+        void record(const LogEvent::ptr &event, size_t size);
+        // 取出环形缓冲中的事件，按写入顺序追加到events并清空缓冲
+        static void TakeRing(RecorderRing &ring, std::vector<LogEvent::ptr> &events);
+
+        // 设置自己的appender并发布新快照，为空时发布父节点的快照，调用方持有树锁和m_mutex
+        void publishNoLock(const AppenderList &appenders);
+        // 根据父节点和快照重新计算继承级别和生效级别，调用方持有树锁和m_mutex
+        void updateEffectiveLevelNoLock();
+        // 自己的级别或快照变化后，重算依赖它的子孙节点，调用方持有树锁和m_mutex
+        void updateChildrenNoLock();
+        // appender级别或格式器变化时由appender调用，重建快照
+        void refreshAppenders();
+        // 向二进制日志登记名称，分配编号
+        uint32_t registerId() const;
+
     private:
         // 日志名称
         std::string m_name;
 
+        // 0表示还没有登记
+        mutable std::atomic<uint32_t> m_id{0};
+
+        std::atomic<bool> m_binaryOnly{false};
+
         // 日志级别
-        LogLevel::Level m_level;
+        std::atomic<LogLevel::Level> m_level;
+        // 继承后的日志器级别，树锁保护
+        LogLevel::Level m_resolvedLevel;
+
+        // 生效级别缓存
+        std::atomic<LogLevel::Level> m_effectiveLevel;
+        // 实际输出的级别，低于它的事件只进飞行记录
+        std::atomic<LogLevel::Level> m_emitLevel{LogLevel::DEBUG};
+
+        // 飞行记录配置，每个线程的缓冲按m_recorderId挂在线程上
+        std::atomic<size_t> m_recordSize{0};
+        std::atomic<LogLevel::Level> m_recordLevel{LogLevel::DEBUG};
+        std::atomic<LogLevel::Level> m_dumpLevel{LogLevel::ERROR};
+        uint64_t m_recorderId;
+        std::vector<std::shared_ptr<RecorderRing>> m_rings;
+        Mutex m_ringsMutex;
 
-        // 输出队列
-        std::list<LogAppender::ptr> m_appenders;
+        // 输出队列，不可变快照，log路径无锁读取；没有自己的appender时和父节点共用同一个快照
+        SnapshotPtr<AppenderSet> m_appenders;
+        // 自己的appender
+        AppenderList m_appenderList;
 
         // 日志格式器
         LogFormatter::ptr m_formatter;
 
-        // 主日志器
-        Logger::ptr m_root;
+        // 父节点和子节点，树锁保护
+        Logger::ptr m_parent;
+        std::vector<Logger *> m_children;
+
+        // 去重阶段，窗口为0时log路径不读快照；快照里的表为空表示不去重
+        // 换表由m_mutex串行化，发布后等旧表的读者离开再释放，释放时汇报未结束的窗口
+        std::atomic<uint32_t> m_dedupWindow{0};
+        SnapshotPtr<LogDedup::ptr> m_dedup;
 
         MutexType m_mutex;
     };
 
+    // 线程局部批量缓冲
+    // 每个线程把格式化好的日志攒在自己的缓冲里，缓冲写满、最早一条等待超过延迟上限
+    // 或遇到flush_level及以上级别时整批交给writer，同一线程的日志顺序不变
+    class LogBatcher
+    {
+    public:
+        typedef std::unique_ptr<LogBatcher> ptr;
+        // 写出一批数据，iov可能由多个线程的缓冲拼成
+        typedef std::function<void(const struct iovec *iov, int count)> Writer;
+
+        // size        单个线程缓冲的字节数上限
+        // latency_ms  日志在缓冲里停留的最长时间，由后台线程约每10ms检查一次
+        // flush_level 达到该级别的日志立即连同缓冲一起写出
+        LogBatcher(size_t size, uint32_t latency_ms, LogLevel::Level flush_level, Writer writer);
+        ~LogBatcher();
+
+        // now 日志时间(微秒)
+        void append(LogLevel::Level level, uint64_t now, const char *data, size_t len);
+        // 写出所有线程的缓冲，expired_only为true时只写超过延迟上限的
+        void flush(bool expired_only = false);
+        // 崩溃时不加锁直接把所有缓冲写到fd
+        void flushOnCrash(int fd);
+
+        size_t getSize() const { return m_size; }
+        uint32_t getLatency() const { return m_latency; }
+        LogLevel::Level getFlushLevel() const { return m_flushLevel; }
+
+    private:
+        // 写出时持锁调用writer，用Mutex而不是SpinLock
+        struct Buffer
+        {
+            Mutex mutex;
+            uint64_t first = 0;
+            std::string data;
+        };
+
+        Buffer &getBuffer();
+        void flushNoLock(Buffer &buffer);
+
+    private:
+        size_t m_size;
+        uint32_t m_latency;
+        LogLevel::Level m_flushLevel;
+        Writer m_writer;
+        uint64_t m_id;
+        std::vector<std::shared_ptr<Buffer>> m_buffers;
+        Mutex m_buffersMutex;
+    };
+
+    // 组提交：写入者把记录追加到待提交缓冲，后台线程把一整批写出后只做一次fdatasync
+    // 写入者可以阻塞到自己的记录落盘，也可以立即返回，之后用sync()等待落盘
+    class LogGroupCommit
+    {
+    public:
+        typedef std::unique_ptr<LogGroupCommit> ptr;
+        // 写出并落盘一批数据，返回是否成功
+        typedef std::function<bool(const std::string &data)> Committer;
+
+        // interval_ms 一批中第一条记录最多等待的时间，0表示立即提交，提交期间到达的记录组成下一批
+        // batch_size  待提交的字节数达到后不再等待
+        // wait        append是否阻塞到记录落盘
+        LogGroupCommit(uint32_t interval_ms, size_t batch_size, bool wait, Committer committer);
+        // 提交剩余的记录后停止后台线程
+        ~LogGroupCommit();
+
+        // 阻塞模式下返回记录所在的一批是否写出并落盘，不阻塞时总是返回true
+        bool append(const char *data, size_t len);
+        // 阻塞到调用前追加的记录全部处理完，返回false表示上次sync之后有提交失败，记录已丢失
+        bool sync();
+        // 崩溃时不加锁把待提交的记录写到fd并落盘
+        void flushOnCrash(int fd);
+
+        uint32_t getInterval() const { return m_interval; }
+        size_t getBatchSize() const { return m_batchSize; }
+        bool isWait() const { return m_wait; }
+        // 已完成的提交次数
+        uint64_t getCommits() const { return m_commits; }
+        // 提交失败丢失的记录条数
+        uint64_t getFailed() const { return m_failed; }
+
+    private:
+        // 等待同一批落盘的写入者和sync在这一批的信号量上等
+        struct Batch
+        {
+            typedef std::shared_ptr<Batch> ptr;
+            Semaphore done;
+            uint32_t waiters = 0;
+            bool ok = true;
+        };
+
+        void run();
+        // 登记为待提交这一批的等待者
+        Batch::ptr waitBatchNoLock();
+
+    private:
+        uint32_t m_interval;
+        size_t m_batchSize;
+        bool m_wait;
+        Committer m_committer;
+        Mutex m_mutex;
+        // 唤醒后台线程
+        Semaphore m_wake;
+        std::string m_pending;
+        // 待提交这一批第一条记录的时间(单调时钟，微秒)
+        uint64_t m_first = 0;
+        // 待提交这一批的等待者，有人等待时才创建
+        Batch::ptr m_batch;
+        // 已追加、已处理的记录条数
+        uint64_t m_appended = 0;
+        uint64_t m_committed = 0;
+        std::atomic<uint64_t> m_commits{0};
+        std::atomic<uint64_t> m_failed{0};
+        // 有提交失败还没通过sync报告
+        bool m_failedUnreported = false;
+        // 有人在等sync，不再攒批
+        bool m_syncing = false;
+        bool m_stopping = false;
+        Thread::ptr m_thread;
+    };
+
     // 输出到控制台
     class StdoutLogAppender : public LogAppender
     {
     public:
         typedef std::shared_ptr<StdoutLogAppender> ptr;
-        virtual void log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override;
+        StdoutLogAppender();
+        ~StdoutLogAppender();
         std::string toYamlString() override;
+        void flushOnCrash() override;
+        // 开启批量写出，size为0时关闭，不能和日志写入并发调用
+        void setBatch(size_t size, uint32_t latency_ms = 100, LogLevel::Level flush_level = LogLevel::ERROR);
+        // 写出批量缓冲中的日志
+        void flush();
+
+    protected:
+        void append(LogLevel::Level level, const LogEvent::ptr &event, const char *data, size_t len) override;
+        bool isFormatShareable() const override { return true; }
+
+    private:
+        void writeBatch(const struct iovec *iov, int count);
+
+    private:
+        LogBatcher::ptr m_batcher;
     };
 
     // 输出到文件
@@ -265,21 +1152,615 @@ namespace sake
     public:
         typedef std::shared_ptr<FileLogAppender> ptr;
         FileLogAppender(const std::string &filename);
-        virtual void log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override;
+        ~FileLogAppender();
         bool reopen();
         std::string toYamlString() override;
+        void flushOnCrash() override;
+        // 开启批量写出，size为0时关闭，不能和日志写入并发调用
+        void setBatch(size_t size, uint32_t latency_ms = 100, LogLevel::Level flush_level = LogLevel::ERROR);
+        // 写出批量缓冲中的日志
+        void flush();
+        // 持久化模式，日志经组提交写出并fdatasync，开启后不再批量写出；不能和日志写入并发调用
+        // 参数含义同LogGroupCommit
+        void setDurable(bool durable, uint32_t interval_ms = 0, size_t batch_size = 256 * 1024, bool wait = true);
+        bool isDurable() const { return (bool)m_commit; }
+        // 阻塞到之前写入的日志全部落盘，返回是否成功；持久化模式下返回上次sync之后是否有提交失败
+        bool sync();
+
+    protected:
+        void append(LogLevel::Level level, const LogEvent::ptr &event, const char *data, size_t len) override;
+        bool isFormatShareable() const override { return true; }
+
+    private:
+        // 以下两个由调用者持有m_fileMutex，打开文件不占用m_mutex，只在换fd时短暂加锁
+        bool reopenNoLock();
+        void checkFile(uint64_t now);
+        void writeBatch(const struct iovec *iov, int count);
+        bool commitBatch(const std::string &data);
 
     private:
         std::string m_filename;
-        std::ofstream m_filestream;
+        int m_fd = -1;
+        LogBatcher::ptr m_batcher;
+        LogGroupCommit::ptr m_commit;
+        // 串行化重新打开，保护以下字段
+        Mutex m_fileMutex;
+        // 后台线程上次检查文件的时间，每秒检查一次是否被外部改名或删除
         uint64_t m_lastTime = 0;
+        dev_t m_dev = 0;
+        ino_t m_ino = 0;
+    };
+
+    // 滚动文件输出，按大小和/或时间窗口切分
+    // 保留个数有限时历史文件依次命名为file.1、file.2...，file.1最新
+    // 全部保留时后缀递增，后缀最大的最新，切分时不再逐个改名
+    // 写日志只写fd；切分、预分配和检查文件是否被外部改名或删除都在后台线程里做，
+    // 写满后到后台线程切分前的日志仍写入旧文件，文件可能略大于max_size
+    class RollingFileLogAppender : public LogAppender
+    {
+    public:
+        typedef std::shared_ptr<RollingFileLogAppender> ptr;
+        // max_size    单个文件字节数上限，0表示不按大小切分
+        // interval    时间窗口秒数，按本地时间对齐，0表示不按时间切分
+        // max_files   保留的历史文件个数，0表示全部保留
+        // preallocate 每次预分配的字节数，0表示不预分配
+        RollingFileLogAppender(const std::string &filename, uint64_t max_size = 0, uint32_t interval = 0,
+                               uint32_t max_files = 0, uint64_t preallocate = 0);
+        ~RollingFileLogAppender();
+
+        bool reopen();
+        // 立即切分当前文件
+        bool rotate();
+        std::string toYamlString() override;
+
+        const std::string &getFilename() const { return m_filename; }
+        uint64_t getMaxSize() const { return m_maxSize; }
+        uint32_t getInterval() const { return m_interval; }
+        uint32_t getMaxFiles() const { return m_maxFiles; }
+        uint64_t getPreallocate() const { return m_preallocate; }
+
+    protected:
+        void append(LogLevel::Level level, const LogEvent::ptr &event, const char *data, size_t len) override;
+        bool isFormatShareable() const override { return true; }
+
+    private:
+        // 以下几个由调用者持有m_fileMutex
+        int openNoLock(uint64_t &size);
+        bool reopenNoLock();
+        bool rotateNoLock(uint64_t now);
+        void preallocateNoLock();
+        void checkFile(uint64_t now);
+        uint64_t nextRollTime(uint64_t now) const;
+
+    private:
+        std::string m_filename;
+        uint64_t m_maxSize;
+        uint32_t m_interval;
+        uint32_t m_maxFiles;
+        uint64_t m_preallocate;
+        // m_mutex保护fd和大小，写日志只用这把锁
+        int m_fd = -1;
+        // 当前文件大小和已预分配到的位置
+        uint64_t m_size = 0;
+        uint64_t m_allocated = 0;
+        // 写满后由写者置位，后台线程切分
+        std::atomic<bool> m_rotatePending{false};
+        // 串行化切分和重新打开，保护以下字段
+        Mutex m_fileMutex;
+        // 下次按时间切分的时刻
+        uint64_t m_nextRoll = 0;
+        uint64_t m_lastCheck = 0;
+        // 全部保留时下一个历史文件的后缀
+        uint32_t m_nextIndex = 1;
+        dev_t m_dev = 0;
+        ino_t m_ino = 0;
+    };
+
+    // 内存映射文件输出，写者用原子偏移占位后直接拷贝进映射窗口
+    // 窗口写满时映射下一段，正常析构时把文件截断到实际长度
+    class MmapFileLogAppender : public LogAppender
+    {
+    public:
+        typedef std::shared_ptr<MmapFileLogAppender> ptr;
+        // window 每次映射的字节数，向上取整到页大小
+        MmapFileLogAppender(const std::string &filename, uint64_t window = 16 * 1024 * 1024);
+        ~MmapFileLogAppender();
+
+        std::string toYamlString() override;
+        // 数据已在共享映射里，只截掉预分配的尾部
+        void flushOnCrash() override;
+
+        const std::string &getFilename() const { return m_filename; }
+        uint64_t getWindowSize() const { return m_windowSize; }
+        // 已写入的字节数(文件逻辑长度)
+        uint64_t getOffset() const { return m_offset; }
+
+    protected:
+        void append(LogLevel::Level level, const LogEvent::ptr &event, const char *data, size_t len) override;
+        bool isFormatShareable() const override { return true; }
+
+    private:
+        // 一段映射，最后一个引用释放时解除映射
+        struct Window
+        {
+            ~Window();
+            char *addr = nullptr;
+            uint64_t base = 0;
+            uint64_t size = 0;
+        };
+
+        // 落在当前窗口外的写入，调用方不能持有窗口读引用
+        void appendSlow(uint64_t offset, const char *data, size_t len);
+        // 从base开始映射新窗口，调用方持有m_mapMutex
+        bool mapNoLock(uint64_t base);
+
+    private:
+        std::string m_filename;
+        uint64_t m_windowSize;
+        int m_fd = -1;
+        // 下一个可占用的文件偏移
+        std::atomic<uint64_t> m_offset{0};
+        SnapshotPtr<Window> m_window;
+        Mutex m_mapMutex;
+    };
+
+    // 共享内存环形缓冲输出，写入只有memcpy和原子操作，不经过系统调用
+    // sake_logtail附加到同名shm对象上实时读取，读者不影响写者，读得慢时旧记录直接被覆盖
+    // 同一个shm对象只应有一个写进程(进程内多线程可并发写)，对象在/dev/shm下保留到手动删除
+    class ShmLogAppender : public LogAppender
+    {
+    public:
+        typedef std::shared_ptr<ShmLogAppender> ptr;
+        static const uint32_t MAGIC = 0x4c4d4853; // "SHML"
+        static const uint32_t VERSION = 1;
+
+        // 共享内存布局：RingHeader，其后是capacity字节的数据区
+        struct RingHeader
+        {
+            uint32_t magic;
+            uint32_t version;
+            uint64_t capacity;
+            // 下一条记录的起始位置(单调增长，对capacity取模得到数据区偏移)
+            alignas(64) std::atomic<uint64_t> reserve;
+        };
+
+        // 数据区内每条记录的头，记录按16字节对齐
+        // pos在内容写完后才写入，等于记录自身的起始位置时记录完整
+        struct Record
+        {
+            std::atomic<uint64_t> pos;
+            uint32_t len;
+            uint32_t check;
+        };
+
+        // name shm对象名，可省略开头的'/'; size 数据区字节数，向上取整到2的幂
+        ShmLogAppender(const std::string &name, uint64_t size = 4 * 1024 * 1024);
+        ~ShmLogAppender();
+
+        std::string toYamlString() override;
+
+        const std::string &getName() const { return m_name; }
+        uint64_t getSize() const { return m_capacity; }
+
+        // 规范化后的shm对象名
+        static std::string ShmName(const std::string &name);
+        static uint32_t Check(uint64_t pos, uint32_t len) { return (uint32_t)(pos >> 32) ^ (uint32_t)pos ^ ~len; }
+
+    protected:
+        void append(LogLevel::Level level, const LogEvent::ptr &event, const char *data, size_t len) override;
+        bool isFormatShareable() const override { return true; }
+
+    private:
+        std::string m_name;
+        uint64_t m_capacity = 0;
+        // 超过的记录截断
+        uint64_t m_maxRecord = 0;
+        RingHeader *m_header = nullptr;
+        char *m_data = nullptr;
     };
 
+    // 发送到本地Unix域socket上的日志采集端(如syslog的/dev/log)
+    // 生产者只把格式化结果追加到缓存，由后台线程成批发送：数据报每条日志一个报文，一次sendmmsg发多条；
+    // 字节流一次sendmsg发出缓存里的全部内容。采集端不可用时日志留在缓存里，后台线程按退避间隔重连，
+    // 缓存超过上限后丢弃新日志，生产者不会阻塞
+    class SocketLogAppender : public LogAppender
+    {
+    public:
+        typedef std::shared_ptr<SocketLogAppender> ptr;
+        // path       socket路径
+        // stream     true用SOCK_STREAM，false用SOCK_DGRAM
+        // spool_size 缓存(含未发完的)字节数上限
+        // syslog     每条日志加上<PRI>前缀，facility为user
+        SocketLogAppender(const std::string &path, bool stream = false, uint64_t spool_size = 4 * 1024 * 1024, bool syslog = false);
+        // 只尝试一次非阻塞发送，未发出的日志计入丢弃
+        ~SocketLogAppender();
+
+        std::string toYamlString() override;
+        // 等待缓存发完，超时返回false
+        bool flush(uint32_t timeout_ms = 1000);
+
+        const std::string &getPath() const { return m_path; }
+        bool isStream() const { return m_stream; }
+        uint64_t getSpoolSize() const { return m_spoolSize; }
+        bool isSyslog() const { return m_syslog; }
+        bool isConnected() const { return m_connected; }
+        // 缓存满、报文过大或析构时没发出而丢弃的条数
+        uint64_t getDropped() const { return m_dropped; }
+
+    protected:
+        void append(LogLevel::Level level, const LogEvent::ptr &event, const char *data, size_t len) override;
+        bool isFormatShareable() const override { return true; }
+
+    private:
+        void run();
+        bool connect();
+        void disconnect();
+        // 发送m_sending中未发出的日志，返回false表示连接出错
+        bool sendStream();
+        bool sendDgram();
+
+    private:
+        std::string m_path;
+        bool m_stream;
+        uint64_t m_spoolSize;
+        bool m_syslog;
+        // 生产者追加的缓存，m_lens是每条日志的长度
+        SpinLock m_spoolMutex;
+        std::string m_spool;
+        std::vector<uint32_t> m_lens;
+        // 后台线程正在发送的一批，m_sendIndex/m_sendPos是下一条未发出的日志及其偏移
+        std::string m_sending;
+        std::vector<uint32_t> m_sendingLens;
+        size_t m_sendIndex = 0;
+        size_t m_sendPos = 0;
+        // 字节流里当前这条已发出的字节数，断线后从这条开头重发
+        size_t m_sendPartial = 0;
+        // 缓存和正在发送的总字节数
+        std::atomic<uint64_t> m_pending{0};
+        std::atomic<uint64_t> m_dropped{0};
+        std::atomic<bool> m_connected{false};
+        std::atomic<bool> m_stopping{false};
+        // 缓存由空变为非空或停止时唤醒后台线程
+        Semaphore m_signal;
+        int m_fd = -1;
+        // 下次重连的时间和退避间隔(毫秒)
+        uint64_t m_retryTime = 0;
+        uint32_t m_backoff = 0;
+        Thread::ptr m_thread;
+    };
+
+    // 读取ShmLogAppender的环形缓冲，不修改共享内存
+    class ShmLogReader
+    {
+    public:
+        enum Result
+        {
+            READ_OK = 0,
+            READ_EMPTY = 1, // 没有新记录
+            READ_BUSY = 2   // 下一条记录还在写
+        };
+
+        ShmLogReader() {}
+        ~ShmLogReader();
+
+        bool open(const std::string &name);
+        // 定位到缓冲里仍保留的最早一条记录，lines非0时只保留最后lines条
+        void seekOldest(size_t lines = 0);
+        // 跳到最新位置，之前的记录计入丢失
+        void resync();
+        // 读一条记录到line
+        Result read(std::string &line);
+
+        uint64_t getPosition() const { return m_pos; }
+        // 被写者覆盖而没读到的字节数
+        uint64_t getLost() const { return m_lost; }
+
+    private:
+        // 读pos处的完整记录，校验通过返回true
+        bool readAt(uint64_t pos, std::string &line, uint64_t &next);
+
+    private:
+        void *m_addr = nullptr;
+        size_t m_mapSize = 0;
+        const ShmLogAppender::RingHeader *m_header = nullptr;
+        const char *m_data = nullptr;
+        uint64_t m_capacity = 0;
+        uint64_t m_pos = 0;
+        uint64_t m_lost = 0;
+    };
+
+    // SAKE_LOG_FMT_*调用点，登记后二进制日志里只记编号
+    struct LogFormatSite
+    {
+        // 文件、行号和函数名取自宏展开处的调用点
+        LogFormatSite(const LogSite *site, LogLevel::Level level, const char *fmt);
+
+        uint32_t id;
+        const char *fmt;
+    };
+
+    // 二进制日志输出，延迟格式化
+    // SAKE_LOG_FMT_*只把调用点编号、时间和原始参数写进线程自己的缓冲，由后台线程成块写入文件
+    // 调用点、日志器名称和格式模板以定义块写入，sake_logdecode据此还原出LogFormatter的文本
+    // 其他日志(流式写法)以已格式化的消息记录
+    class BinaryLogAppender : public LogAppender
+    {
+    public:
+        typedef std::shared_ptr<BinaryLogAppender> ptr;
+        // 文件格式
+        enum ChunkType : uint8_t
+        {
+            CHUNK_DATA = 1,   // u32 tid, u16+线程名, 记录...
+            CHUNK_SITE = 2,   // u32 id, u8 level, u32 line, u16+文件名, u32+格式串, u16+函数名
+            CHUNK_LOGGER = 3, // u32 id, u16+名称
+            CHUNK_PATTERN = 4 // u32+格式模板
+        };
+        enum RecordType : uint8_t
+        {
+            RECORD_FORMAT = 1, // u8 level, u32 site, u32 logger, u64 time_us, u32 fiber, u32 elapse, MDC, u8 argc, 参数...
+            RECORD_TEXT = 2    // u8 level, u32 logger, u64 time_us, u32 fiber, u32 elapse, MDC, u32 line, u16+文件名, u16+函数名, u32+消息, u8 字段数, 字段...
+        };
+        // MDC：u8 项数, 每项u8+键, u8+值
+        // 参数类型标记
+        enum ArgType : uint8_t
+        {
+            ARG_INT = 'i',    // int64
+            ARG_UINT = 'u',   // uint64
+            ARG_DOUBLE = 'f', // double
+            ARG_STRING = 's', // u32+字节
+            ARG_POINTER = 'p' // uint64
+        };
+        // 块头：u32 magic, u8 type, u32 length
+        static const uint32_t MAGIC = 0x4c424b53;
+        static const size_t CHUNK_HEADER_SIZE = 9;
+
+        BinaryLogAppender(const std::string &filename);
+        ~BinaryLogAppender();
+
+        void log(Logger *logger, LogLevel::Level level, const LogEvent::ptr &event) override;
+        std::string toYamlString() override;
+        void flushOnCrash() override;
+
+        template <class... Args>
+        void write(Logger *logger, LogLevel::Level level, uint32_t site, const Args &...args);
+
+        // 写出所有线程缓冲
+        void flush();
+        // 停止后台线程并写出剩余数据
+        void stop();
+        // 原子写入一个完整的块
+        void writeChunk(const std::string &chunk);
+
+        const std::string &getFilename() const { return m_filename; }
+
+    private:
+        // 线程自己的缓冲，只有所属线程和后台刷新线程访问
+        struct ThreadBuffer
+        {
+            SpinLock mutex;
+            uint32_t threadId;
+            std::string threadName;
+            std::string data;
+        };
+
+        ThreadBuffer &getThreadBuffer();
+        void flushNoLock(ThreadBuffer &buffer);
+        void run();
+
+        static void Put(std::string &buf, const void *data, size_t len) { buf.append((const char *)data, len); }
+        template <class T>
+        static void PutValue(std::string &buf, T v) { Put(buf, &v, sizeof(v)); }
+
+        static void EncodeMdc(std::string &buf, const LogMdc &mdc);
+        static void EncodeArg(std::string &buf, const char *v);
+        static void EncodeArg(std::string &buf, char *v) { EncodeArg(buf, (const char *)v); }
+        static void EncodeArg(std::string &buf, double v)
+        {
+            buf.push_back(ARG_DOUBLE);
+            PutValue(buf, v);
+        }
+        template <class T>
+        static void EncodeArg(std::string &buf, T v, typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type * = nullptr)
+        {
+            if ((T)-1 < (T)0)
+            {
+                buf.push_back(ARG_INT);
+                PutValue(buf, (int64_t)v);
+            }
+            else
+            {
+                buf.push_back(ARG_UINT);
+                PutValue(buf, (uint64_t)v);
+            }
+        }
+        template <class T>
+        static void EncodeArg(std::string &buf, T *v)
+        {
+            buf.push_back(ARG_POINTER);
+            PutValue(buf, (uint64_t)(uintptr_t)v);
+        }
+        static void EncodeArgs(std::string &buf) {}
+        template <class T, class... Args>
+        static void EncodeArgs(std::string &buf, const T &v, const Args &...args)
+        {
+            EncodeArg(buf, v);
+            EncodeArgs(buf, args...);
+        }
+
+    private:
+        std::string m_filename;
+        int m_fd = -1;
+        // 进程内唯一编号，线程局部缓冲按它查找，避免appender地址复用后串线
+        uint64_t m_id;
+        // 最近一次写入文件的格式模板
+        LogFormatter::ptr m_pattern;
+        std::vector<std::shared_ptr<ThreadBuffer>> m_buffers;
+        Mutex m_buffersMutex;
+        std::atomic<bool> m_stopping{false};
+        Thread::ptr m_thread;
+    };
+
+    template <class... Args>
+    void BinaryLogAppender::write(Logger *logger, LogLevel::Level level, uint32_t site, const Args &...args)
+    {
+        if (level < getLevel())
+        {
+            return;
+        }
+        uint64_t now = util::GetCurrentUS();
+        ThreadBuffer &buffer = getThreadBuffer();
+        SpinLock::Lock lock(buffer.mutex);
+        std::string &buf = buffer.data;
+        buf.push_back(RECORD_FORMAT);
+        buf.push_back((char)level);
+        PutValue(buf, site);
+        PutValue(buf, logger->getId());
+        PutValue(buf, now);
+        PutValue(buf, util::GetFiberId());
+        PutValue(buf, (uint32_t)0);
+        EncodeMdc(buf, *LogMdc::Current());
+        buf.push_back((char)sizeof...(Args));
+        EncodeArgs(buf, args...);
+        if (buf.size() >= 64 * 1024)
+        {
+            flushNoLock(buffer);
+        }
+    }
+
+    template <class... Args>
+    bool Logger::logBinary(LogLevel::Level level, uint32_t site, const Args &...args)
+    {
+        SnapshotPtr<AppenderSet>::ReadGuard set(m_appenders);
+        if (set->binary.empty() || set->binary.size() != set->appenders.size())
+        {
+            return false;
+        }
+        for (auto &i : set->binary)
+        {
+            i->write(this, level, site, args...);
+        }
+        return true;
+    }
+
+    // 只用于SAKE_LOG_FMT_CHECK的编译期检查，不会被调用
+    inline void LogFormatCheck(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+    inline void LogFormatCheck(const char *fmt, ...) {}
+
+    // SAKE_LOG_FMT_*的实现，纯二进制日志器走延迟格式化，其余照常printf
+    template <class SiteFunc, class... Args>
+    void LogFormatWrite(const Logger::ptr &logger, LogLevel::Level level, const LogSite *log_site,
+                        SiteFunc site, const char *fmt, const Args &...args)
+    {
+        if (logger->isBinaryOnly())
+        {
+            const LogFormatSite &s = site();
+            if (s.fmt == fmt && logger->logBinary(level, s.id, args...))
+            {
+                return;
+            }
+        }
+        LogEventWrap(logger, level, log_site).getEvent()->format(fmt, args...);
+    }
+
+    // 异步输出，事件写入有界MPSC环形队列，由后台线程转交内部appender
+    class AsyncLogAppender : public LogAppender
+    {
+    public:
+        typedef std::shared_ptr<AsyncLogAppender> ptr;
+        // 队列满时的处理策略
+        enum OverflowPolicy
+        {
+            BLOCK = 0,           // 阻塞生产者直到有空位
+            DROP_NEWEST = 1,     // 丢弃当前事件
+            DROP_DEBUG_FIRST = 2 // 队列超过3/4时丢弃DEBUG事件，满时阻塞其余事件
+        };
+        static const char *ToString(OverflowPolicy policy);
+        static OverflowPolicy PolicyFromString(const std::string &str);
+
+        AsyncLogAppender(size_t capacity = 8192, OverflowPolicy policy = BLOCK);
+        ~AsyncLogAppender();
+
+        virtual void log(Logger *logger, LogLevel::Level level, const LogEvent::ptr &event) override;
+        std::string toYamlString() override;
+        void setDefaultFormatter(LogFormatter::ptr formatter) override;
+        // 等后台线程把队列里的事件交给内部appender(最多1秒)，再写出内部appender的缓冲
+        void flushOnCrash() override;
+
+        // 添加内部落地目标
+        void addAppender(LogAppender::ptr appender);
+        // 停止后台线程，队列中剩余事件会先全部落地
+        void stop();
+
+        size_t getCapacity() const { return m_mask + 1; }
+        OverflowPolicy getPolicy() const { return m_policy; }
+        uint64_t getDropped() const { return m_dropped; }
+
+    private:
+        // 日志器由事件持有
+        struct Item
+        {
+            LogLevel::Level level = LogLevel::UNKOWN;
+            LogEvent::ptr event;
+        };
+
+        struct Slot
+        {
+            std::atomic<size_t> seq;
+            Item item;
+        };
+
+        bool tryPush(Item &item);
+        bool tryPop(Item &item);
+        size_t size() const;
+        void wakeup();
+        void run();
+
+    private:
+        std::unique_ptr<Slot[]> m_slots;
+        size_t m_mask = 0;
+        OverflowPolicy m_policy;
+        // 生产者写位置，消费者读位置，用填充分开cache line避免伪共享
+        char m_pad0[64];
+        std::atomic<size_t> m_head{0};
+        char m_pad1[64];
+        std::atomic<size_t> m_tail{0};
+        char m_pad2[64];
+        std::atomic<bool> m_sleeping{false};
+        std::atomic<bool> m_stopping{false};
+        std::atomic<uint64_t> m_dropped{0};
+        Semaphore m_semaphore;
+        // m_mutex保护，每次修改后版本号加一，后台线程据此更新自己的副本
+        std::vector<LogAppender::ptr> m_appenders;
+        std::atomic<uint64_t> m_appendersVersion{0};
+        Thread::ptr m_thread;
+    };
+
+    // 崩溃处理
+    // 收到SIGSEGV/SIGBUS/SIGFPE/SIGILL/SIGABRT时输出信号、调用栈和可执行映射，
+    // 写出已登记appender缓冲中的日志，然后恢复默认处理重新触发信号
+    // 带缓冲的appender在构造时登记，析构时注销；登记表是定长原子数组，信号处理函数里不加锁
+    class LogCrashHandler
+    {
+    public:
+        // 安装信号处理函数，调用栈写到fd；当前线程同时设置备用信号栈，栈溢出时也能处理
+        static void Install(int fd = STDERR_FILENO);
+        // 写出所有已登记appender的缓冲，可在信号处理函数中调用
+        static void Flush();
+        // last为true的appender在其他appender之后处理，异步appender要等待后台线程
+        static void Register(LogAppender *appender, bool last = false);
+        static void Unregister(LogAppender *appender);
+    };
+
+    // 日志器注册表，读多写少
+    // 查找已有日志器只读不可变快照，不加锁；创建新日志器时加锁拷贝一份新表发布
     class LoggerManager
     {
     public:
-        typedef SpinLock MutexType;
+        // 发布快照时要等读者退出，用互斥锁不用自旋锁
+        typedef Mutex MutexType;
+        typedef std::unordered_map<std::string, Logger::ptr> LoggerMap;
         LoggerManager();
+        // 不存在时创建，新日志器挂到最近的祖先下，原来挂在该祖先下的后代改挂到新日志器
         Logger::ptr getLogger(const std::string &name);
         void init();
         Logger::ptr getRoot() const { return m_root; }
@@ -288,7 +1769,7 @@ namespace sake
 
     private:
         // 日志容器
-        std::map<std::string, Logger::ptr> m_loggers;
+        SnapshotPtr<LoggerMap> m_loggers;
 
         // 主日志器
         Logger::ptr m_root;
@@ -1,6 +1,7 @@
 #include "thread.h"
 #include "log.h"
 #include "util.h"
+#include <errno.h>
 
 namespace sake
 {
@@ -26,6 +27,27 @@ namespace sake
         }
     }
 
+    bool Semaphore::waitFor(uint64_t timeout_us)
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        uint64_t nsec = ts.tv_nsec + timeout_us % 1000000 * 1000;
+        ts.tv_sec += timeout_us / 1000000 + nsec / 1000000000;
+        ts.tv_nsec = nsec % 1000000000;
+        while (sem_timedwait(&m_semaphore, &ts))
+        {
+            if (errno == ETIMEDOUT)
+            {
+                return false;
+            }
+            if (errno != EINTR)
+            {
+                throw std::logic_error("sem_timedwait failed");
+            }
+        }
+        return true;
+    }
+
     void Semaphore::notify()
     {
         if (sem_post(&m_semaphore))
@@ -5,6 +5,7 @@
 #include <functional>
 #include <semaphore.h>
 #include <atomic>
+#include <sched.h>
 
 namespace sake
 {
@@ -15,6 +16,8 @@ namespace sake
         ~Semaphore();
 
         void wait();
+        // 最多等待timeout_us微秒，超时返回false
+        bool waitFor(uint64_t timeout_us);
         void notify();
 
     private:
@@ -272,6 +275,102 @@ namespace sake
     private:
         volatile std::atomic_flag m_mutex;
     };
+    // 读多写少的不可变快照
+    // 读者通过ReadGuard访问当前快照，只有两次原子计数，不加锁
+    // 写者需自行串行化，publish发布新快照后等待旧快照上的读者退出再释放旧快照
+    // 注意：不能在持有同一个SnapshotPtr的ReadGuard时调用publish
+    template <class T>
+    class SnapshotPtr
+    {
+    public:
+        class ReadGuard
+        {
+        public:
+            ReadGuard(const SnapshotPtr &ptr) : m_ptr(ptr), m_index(ptr.enter()) {}
+            ~ReadGuard() { m_ptr.leave(m_index); }
+
+            const T *get() const { return m_ptr.m_slots[m_index].get(); }
+            const T *operator->() const { return get(); }
+            const T &operator*() const { return *get(); }
+
+        private:
+            ReadGuard(const ReadGuard &) = delete;
+            ReadGuard &operator=(const ReadGuard &) = delete;
+
+        private:
+            const SnapshotPtr &m_ptr;
+            unsigned m_index;
+        };
+
+        SnapshotPtr(std::shared_ptr<const T> value = std::make_shared<T>())
+        {
+            m_slots[0] = value;
+        }
+
+        // 写者读取当前快照，用于拷贝后修改
+        std::shared_ptr<const T> get() const
+        {
+            return m_slots[m_index.load()];
+        }
+
+        // 发布新快照，返回时旧快照已没有读者
+        void publish(std::shared_ptr<const T> value)
+        {
+            unsigned cur = m_index.load();
+            unsigned next = cur ^ 1;
+            waitReaders(next);
+            m_slots[next] = value;
+            m_index.store(next);
+            waitReaders(cur);
+            m_slots[cur].reset();
+        }
+
+    private:
+        unsigned enter() const
+        {
+            while (true)
+            {
+                unsigned index = m_index.load();
+                m_readers[index].count.fetch_add(1);
+                // 计数后再确认一次，避免写者已经切换并开始回收该槽位
+                if (m_index.load() == index)
+                {
+                    return index;
+                }
+                m_readers[index].count.fetch_sub(1);
+            }
+        }
+
+        void leave(unsigned index) const
+        {
+            m_readers[index].count.fetch_sub(1, std::memory_order_release);
+        }
+
+        void waitReaders(unsigned index) const
+        {
+            while (m_readers[index].count.load())
+            {
+                sched_yield();
+            }
+        }
+
+    private:
+        SnapshotPtr(const SnapshotPtr &) = delete;
+        SnapshotPtr &operator=(const SnapshotPtr &) = delete;
+
+        // 读者计数独占cache line
+        struct Readers
+        {
+            std::atomic<int64_t> count{0};
+            char pad[64 - sizeof(std::atomic<int64_t>)];
+        };
+
+    private:
+        std::shared_ptr<const T> m_slots[2];
+        std::atomic<unsigned> m_index{0};
+        mutable Readers m_readers[2];
+    };
+
     class Thread
     {
     public:
@@ -1,4 +1,5 @@
 #include <execinfo.h>
+#include <time.h>
 #include "util.h"
 #include "log.h"
 #include "fiber.h"
@@ -9,7 +10,13 @@ namespace sake
     pid_t
     util::GetThreadId()
     {
-        return syscall(SYS_gettid);
+        // 线程id不会变，缓存起来避免每条日志一次系统调用
+        static thread_local pid_t t_tid = 0;
+        if (!t_tid)
+        {
+            t_tid = syscall(SYS_gettid);
+        }
+        return t_tid;
     }
 
     uint32_t util::GetFiberId()
@@ -17,6 +24,13 @@ namespace sake
         return sake::Fiber::GetFiberId();
     }
 
+    uint64_t util::GetCurrentUS()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    }
+
     void util::Backtrace(std::vector<std::string> &bt, int size, int skip = 1)
     {
         void **array = (void **)malloc(sizeof(void *) * size);
@@ -55,4 +69,44 @@ namespace sake
         }
         return ss.str();
     }
+
+    void util::BacktraceToFd(int fd, int size, int skip)
+    {
+        void *array[128];
+        if (size > 128)
+        {
+            size = 128;
+        }
+        int n = ::backtrace(array, size);
+        for (int i = skip; i < n; ++i)
+        {
+            // "#NN 0x...\n"，逐位转换，不用printf
+            char line[32];
+            size_t len = 0;
+            line[len++] = '#';
+            int index = i - skip;
+            if (index >= 100)
+            {
+                line[len++] = '0' + index / 100;
+            }
+            if (index >= 10)
+            {
+                line[len++] = '0' + index / 10 % 10;
+            }
+            line[len++] = '0' + index % 10;
+            line[len++] = ' ';
+            line[len++] = '0';
+            line[len++] = 'x';
+            uintptr_t addr = (uintptr_t)array[i];
+            for (int shift = sizeof(addr) * 8 - 4; shift >= 0; shift -= 4)
+            {
+                line[len++] = "0123456789abcdef"[(addr >> shift) & 0xf];
+            }
+            line[len++] = '\n';
+            if (::write(fd, line, len) < 0)
+            {
+                return;
+            }
+        }
+    }
 }
@@ -13,7 +13,11 @@ namespace sake
     public:
         static pid_t GetThreadId();
         static uint32_t GetFiberId();
+        // 当前时间(微秒)
+        static uint64_t GetCurrentUS();
         static void Backtrace(std::vector<std::string> &bt, int size, int skip);
         static std::string BacktraceToString(int size, int skip, const std::string &prefix = "");
+        // 只输出地址的调用栈，不分配内存、不解析符号，可在信号处理函数中使用
+        static void BacktraceToFd(int fd, int size, int skip);
     };
 };
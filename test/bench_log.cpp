@@ -0,0 +1,339 @@
+// 日志性能基准，按格式模板、appender类型、写法和生产者线程数分组测量
+// 用法: bench_log [-n events] [-t max_threads] [-d dir] [-o out.json]
+// 结果以JSON输出，ns_per_event为墙钟时间除以总条数，只算生产者侧(异步/批量appender不含后台落盘)
+#include "sake.h"
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <vector>
+
+// 不落地的appender，只测格式化和分发开销
+class NullLogAppender : public sake::LogAppender
+{
+public:
+    std::string toYamlString() override { return "type: NullLogAppender"; }
+
+protected:
+    void append(sake::LogLevel::Level level, const sake::LogEvent::ptr &event, const char *data, size_t len) override {}
+    bool isFormatShareable() const override { return true; }
+};
+
+enum Macro
+{
+    MACRO_STREAM,
+    MACRO_FMT,
+    MACRO_PRINT,
+    MACRO_STREAM_FILTERED,
+    MACRO_FMT_FILTERED
+};
+
+static const char *MacroName(Macro macro)
+{
+    switch (macro)
+    {
+    case MACRO_STREAM:
+        return "stream";
+    case MACRO_FMT:
+        return "fmt";
+    case MACRO_PRINT:
+        return "print";
+    case MACRO_STREAM_FILTERED:
+        return "stream_filtered";
+    case MACRO_FMT_FILTERED:
+        return "fmt_filtered";
+    }
+    return "unknown";
+}
+
+static void LogOnce(Macro macro, const sake::Logger::ptr &logger, int i)
+{
+    switch (macro)
+    {
+    case MACRO_STREAM:
+        SAKE_LOG_INFO(logger) << "bench message " << i << " value " << 3.25;
+        break;
+    case MACRO_FMT:
+        SAKE_LOG_FMT_INFO(logger, "bench message %d value %g", i, 3.25);
+        break;
+    case MACRO_PRINT:
+        SAKE_LOG_PRINT_INFO(logger, "bench message {} value {}", i, 3.25);
+        break;
+    case MACRO_STREAM_FILTERED:
+        SAKE_LOG_DEBUG(logger) << "bench message " << i << " value " << 3.25;
+        break;
+    case MACRO_FMT_FILTERED:
+        SAKE_LOG_FMT_DEBUG(logger, "bench message %d value %g", i, 3.25);
+        break;
+    }
+}
+
+static uint64_t NowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+struct Case
+{
+    std::string appender;
+    std::string pattern;
+    Macro macro;
+    int threads;
+};
+
+struct Result
+{
+    Case c;
+    uint64_t events;
+    double nsPerEvent;
+    double eventsPerSec;
+    uint64_t p50;
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+};
+
+static const char *PatternOf(const std::string &name)
+{
+    if (name == "message")
+    {
+        return "%m%n";
+    }
+    if (name == "json")
+    {
+        return "%J%n";
+    }
+    return "%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n";
+}
+
+static sake::LogAppender::ptr CreateAppender(const std::string &name, const std::string &path)
+{
+    if (name == "file")
+    {
+        return sake::LogAppender::ptr(new sake::FileLogAppender(path));
+    }
+    if (name == "file_batch")
+    {
+        sake::FileLogAppender::ptr file(new sake::FileLogAppender(path));
+        file->setBatch(64 * 1024);
+        return file;
+    }
+    if (name == "rolling")
+    {
+        return sake::LogAppender::ptr(new sake::RollingFileLogAppender(path, 64 * 1024 * 1024));
+    }
+    if (name == "mmap")
+    {
+        return sake::LogAppender::ptr(new sake::MmapFileLogAppender(path));
+    }
+    if (name == "async")
+    {
+        sake::AsyncLogAppender::ptr async(new sake::AsyncLogAppender);
+        async->addAppender(sake::LogAppender::ptr(new sake::FileLogAppender(path)));
+        return async;
+    }
+    if (name == "shm")
+    {
+        return sake::LogAppender::ptr(new sake::ShmLogAppender("sake_bench", 64 * 1024 * 1024));
+    }
+    if (name == "binary")
+    {
+        return sake::LogAppender::ptr(new sake::BinaryLogAppender(path));
+    }
+    return sake::LogAppender::ptr(new NullLogAppender);
+}
+
+// 所有线程就绪后同时开始，返回总耗时；latencies非空时逐条计时
+static uint64_t RunThreads(const sake::Logger::ptr &logger, const Case &c, uint64_t events,
+                           std::vector<std::vector<uint32_t>> *latencies)
+{
+    std::atomic<int> ready{0};
+    std::atomic<bool> go{false};
+    std::vector<sake::Thread::ptr> threads;
+    for (int t = 0; t < c.threads; ++t)
+    {
+        threads.push_back(sake::Thread::ptr(new sake::Thread([&, t]()
+                                                             {
+            std::vector<uint32_t> *lat = latencies ? &(*latencies)[t] : nullptr;
+            if (lat)
+            {
+                lat->reserve(events);
+            }
+            ++ready;
+            while (!go)
+            {
+            }
+            for (uint64_t i = 0; i < events; ++i)
+            {
+                if (lat)
+                {
+                    uint64_t begin = NowNs();
+                    LogOnce(c.macro, logger, i);
+                    lat->push_back(NowNs() - begin);
+                }
+                else
+                {
+                    LogOnce(c.macro, logger, i);
+                }
+            } }, "bench_" + std::to_string(t))));
+    }
+    while (ready != c.threads)
+    {
+        sched_yield();
+    }
+    uint64_t begin = NowNs();
+    go = true;
+    for (auto &i : threads)
+    {
+        i->join();
+    }
+    return NowNs() - begin;
+}
+
+static Result RunCase(const Case &c, uint64_t events, const std::string &dir)
+{
+    std::string path = dir + "/bench_" + c.appender + ".log";
+    unlink(path.c_str());
+    sake::Logger::ptr logger = SAKE_LOG_NAME("bench");
+    logger->clearAppenders();
+    logger->setLevel(sake::LogLevel::INFO);
+    logger->setLogFormatter(PatternOf(c.pattern));
+    logger->addAppender(CreateAppender(c.appender, path));
+
+    Result r;
+    r.c = c;
+    r.events = events * c.threads;
+    // 第一遍只测吞吐，第二遍逐条计时取分位数
+    uint64_t total = RunThreads(logger, c, events, nullptr);
+    std::vector<std::vector<uint32_t>> latencies(c.threads);
+    RunThreads(logger, c, events, &latencies);
+    logger->clearAppenders();
+    unlink(path.c_str());
+    shm_unlink("/sake_bench");
+
+    r.nsPerEvent = (double)total / r.events;
+    r.eventsPerSec = r.events * 1e9 / total;
+    std::vector<uint32_t> all;
+    all.reserve(r.events);
+    for (auto &i : latencies)
+    {
+        all.insert(all.end(), i.begin(), i.end());
+    }
+    std::sort(all.begin(), all.end());
+    r.p50 = all[all.size() / 2];
+    r.p99 = all[all.size() * 99 / 100];
+    r.p999 = all[all.size() * 999 / 1000];
+    r.max = all.back();
+    return r;
+}
+
+static void WriteJson(std::ostream &os, uint64_t events, const std::vector<Result> &results)
+{
+    char buf[64];
+    os << "{\n  \"library\": \"libsake\",\n  \"events_per_thread\": " << events << ",\n  \"results\": [";
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const Result &r = results[i];
+        os << (i ? ",\n" : "\n") << "    {\"appender\": \"" << r.c.appender << "\", \"pattern\": \"" << r.c.pattern
+           << "\", \"macro\": \"" << MacroName(r.c.macro) << "\", \"threads\": " << r.c.threads
+           << ", \"events\": " << r.events;
+        snprintf(buf, sizeof(buf), "%.1f", r.nsPerEvent);
+        os << ", \"ns_per_event\": " << buf;
+        snprintf(buf, sizeof(buf), "%.0f", r.eventsPerSec);
+        os << ", \"events_per_sec\": " << buf << ", \"p50_ns\": " << r.p50 << ", \"p99_ns\": " << r.p99
+           << ", \"p999_ns\": " << r.p999 << ", \"max_ns\": " << r.max << "}";
+    }
+    os << "\n  ]\n}\n";
+}
+
+static void Usage(const char *name)
+{
+    std::cout << "usage: " << name << " [-n events] [-t max_threads] [-d dir] [-o out.json]" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t events = 100000;
+    int max_threads = std::min(std::max((int)sysconf(_SC_NPROCESSORS_ONLN), 1), 8);
+    std::string dir = "/tmp";
+    std::string out;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:t:d:o:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            events = std::max(strtoull(optarg, nullptr, 10), 1ull);
+            break;
+        case 't':
+            max_threads = std::max(atoi(optarg), 1);
+            break;
+        case 'd':
+            dir = optarg;
+            break;
+        case 'o':
+            out = optarg;
+            break;
+        default:
+            Usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    std::vector<Case> cases;
+    // 格式模板：不落地，只测格式化
+    for (auto &pattern : {"message", "default", "json"})
+    {
+        cases.push_back(Case{"null", pattern, MACRO_STREAM, 1});
+    }
+    // 写法，包括被级别过滤掉的语句
+    for (auto macro : {MACRO_FMT, MACRO_PRINT, MACRO_STREAM_FILTERED, MACRO_FMT_FILTERED})
+    {
+        cases.push_back(Case{"null", "default", macro, 1});
+    }
+    cases.push_back(Case{"binary", "default", MACRO_FMT, 1});
+    // 线程数：1、2、4...小于max_threads的2的幂，最后是max_threads
+    std::vector<int> thread_counts;
+    for (int threads = 1; threads < max_threads; threads *= 2)
+    {
+        thread_counts.push_back(threads);
+    }
+    thread_counts.push_back(max_threads);
+    // appender类型 x 线程数
+    for (auto &appender : {"null", "file", "file_batch", "rolling", "mmap", "shm", "async", "binary"})
+    {
+        for (int threads : thread_counts)
+        {
+            cases.push_back(Case{appender, "default", MACRO_STREAM, threads});
+        }
+    }
+
+    std::vector<Result> results;
+    for (auto &c : cases)
+    {
+        results.push_back(RunCase(c, events, dir));
+        const Result &r = results.back();
+        std::cerr << c.appender << "/" << c.pattern << "/" << MacroName(c.macro) << "/" << c.threads
+                  << ": " << r.nsPerEvent << " ns/event p99=" << r.p99 << "ns" << std::endl;
+    }
+
+    if (out.empty())
+    {
+        WriteJson(std::cout, events, results);
+    }
+    else
+    {
+        std::ofstream ofs(out);
+        if (!ofs)
+        {
+            std::cerr << "open " << out << " failed" << std::endl;
+            return 1;
+        }
+        WriteJson(ofs, events, results);
+    }
+    return 0;
+}
@@ -0,0 +1,544 @@
+// 把BinaryLogAppender写出的二进制日志还原成LogFormatter格式的文本
+// 用法: sake_logdecode [-p pattern] file
+#include "log.h"
+#include <stdio.h>
+#include <unistd.h>
+#include <fstream>
+#include <iterator>
+#include <unordered_map>
+
+using sake::BinaryLogAppender;
+
+// 还原出的调用点，字符串由自己持有
+struct DecodedSite
+{
+    DecodedSite(const std::string &f, int32_t l, const std::string &fn)
+        : file(f), lineStr(std::to_string(l)), func(fn), site(file.c_str(), l, lineStr.c_str(), func.c_str(), sake::LogLevel::UNKOWN) {}
+
+    std::string file;
+    std::string lineStr;
+    std::string func;
+    sake::LogSite site;
+};
+
+// 调用点定义
+struct Site
+{
+    sake::LogLevel::Level level;
+    std::string fmt;
+    std::unique_ptr<DecodedSite> decoded;
+};
+
+// 一个参数，类型由写入方的C++类型决定
+struct Arg
+{
+    uint8_t type;
+    uint64_t u;
+    double d;
+    std::string s;
+};
+
+// 顺序读取，越界后ok()为false，后续读取都返回0
+class Reader
+{
+public:
+    Reader(const char *data, size_t size) : m_data(data), m_size(size) {}
+
+    template <class T>
+    T get()
+    {
+        T v = T();
+        if (need(sizeof(T)))
+        {
+            memcpy(&v, m_data + m_pos, sizeof(T));
+            m_pos += sizeof(T);
+        }
+        return v;
+    }
+
+    std::string str(size_t len)
+    {
+        if (!need(len))
+        {
+            return std::string();
+        }
+        std::string v(m_data + m_pos, len);
+        m_pos += len;
+        return v;
+    }
+
+    const char *pos() const { return m_data + m_pos; }
+    void skip(size_t len)
+    {
+        if (need(len))
+        {
+            m_pos += len;
+        }
+    }
+
+    bool ok() const { return m_ok; }
+    bool eof() const { return m_pos >= m_size; }
+
+private:
+    bool need(size_t len)
+    {
+        if (m_pos + len > m_size)
+        {
+            m_ok = false;
+            m_pos = m_size;
+        }
+        return m_ok;
+    }
+
+private:
+    const char *m_data;
+    size_t m_size;
+    size_t m_pos = 0;
+    bool m_ok = true;
+};
+
+// 整数按长度修饰截断，和printf按该类型读取参数的结果一致
+static int64_t CastSigned(const std::string &length, int64_t v)
+{
+    if (length == "hh")
+        return (signed char)v;
+    if (length == "h")
+        return (short)v;
+    if (length == "l")
+        return (long)v;
+    if (length == "ll" || length == "q" || length == "j")
+        return v;
+    if (length == "z" || length == "t")
+        return (ssize_t)v;
+    return (int)v;
+}
+
+static uint64_t CastUnsigned(const std::string &length, uint64_t v)
+{
+    if (length == "hh")
+        return (unsigned char)v;
+    if (length == "h")
+        return (unsigned short)v;
+    if (length == "l")
+        return (unsigned long)v;
+    if (length == "ll" || length == "q" || length == "j")
+        return v;
+    if (length == "z" || length == "t")
+        return (size_t)v;
+    return (unsigned int)v;
+}
+
+// 按printf语义格式化，参数不够时原样输出转换说明
+static void RenderFormat(std::string &out, const std::string &fmt, const std::vector<Arg> &args)
+{
+    size_t next = 0;
+    char buf[512];
+    for (size_t i = 0; i < fmt.size(); ++i)
+    {
+        if (fmt[i] != '%')
+        {
+            out.push_back(fmt[i]);
+            continue;
+        }
+        if (i + 1 < fmt.size() && fmt[i + 1] == '%')
+        {
+            out.push_back('%');
+            ++i;
+            continue;
+        }
+        size_t begin = i++;
+        std::string spec = "%";
+        std::vector<int> stars;
+        while (i < fmt.size() && strchr("-+ #0", fmt[i]))
+        {
+            spec.push_back(fmt[i++]);
+        }
+        // 宽度和精度可以是*，各自消耗一个int参数
+        for (int part = 0; part < 2; ++part)
+        {
+            if (part == 1)
+            {
+                if (i >= fmt.size() || fmt[i] != '.')
+                {
+                    break;
+                }
+                spec.push_back(fmt[i++]);
+            }
+            if (i < fmt.size() && fmt[i] == '*')
+            {
+                spec.push_back(fmt[i++]);
+                stars.push_back(next < args.size() ? (int)args[next++].u : 0);
+            }
+            while (i < fmt.size() && isdigit(fmt[i]))
+            {
+                spec.push_back(fmt[i++]);
+            }
+        }
+        std::string length;
+        while (i < fmt.size() && strchr("hljztLq", fmt[i]))
+        {
+            length.push_back(fmt[i++]);
+        }
+        if (i >= fmt.size())
+        {
+            out.append(fmt, begin, std::string::npos);
+            break;
+        }
+        char conv = fmt[i];
+        if (conv == 'n')
+        {
+            continue;
+        }
+        if (next >= args.size())
+        {
+            out.append(fmt, begin, i + 1 - begin);
+            continue;
+        }
+        const Arg &arg = args[next++];
+        int w = stars.size() > 0 ? stars[0] : 0;
+        int p = stars.size() > 1 ? stars[1] : 0;
+        int len = 0;
+#define XX(spec_str, value)                                                                   \
+    if (stars.size() == 0)                                                                    \
+        len = snprintf(buf, sizeof(buf), spec_str.c_str(), value);                            \
+    else if (stars.size() == 1)                                                               \
+        len = snprintf(buf, sizeof(buf), spec_str.c_str(), w, value);                         \
+    else                                                                                      \
+        len = snprintf(buf, sizeof(buf), spec_str.c_str(), w, p, value);
+        switch (conv)
+        {
+        case 'd':
+        case 'i':
+        {
+            std::string s = spec + "ll" + conv;
+            long long v = CastSigned(length, arg.type == BinaryLogAppender::ARG_DOUBLE ? (int64_t)arg.d : (int64_t)arg.u);
+            XX(s, v);
+            break;
+        }
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+        {
+            std::string s = spec + "ll" + conv;
+            unsigned long long v = CastUnsigned(length, arg.type == BinaryLogAppender::ARG_DOUBLE ? (uint64_t)arg.d : arg.u);
+            XX(s, v);
+            break;
+        }
+        case 'c':
+        {
+            std::string s = spec + conv;
+            XX(s, (int)arg.u);
+            break;
+        }
+        case 'e':
+        case 'E':
+        case 'f':
+        case 'F':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+        {
+            std::string s = spec + conv;
+            double v = arg.type == BinaryLogAppender::ARG_DOUBLE ? arg.d : (double)(int64_t)arg.u;
+            XX(s, v);
+            break;
+        }
+        case 's':
+        {
+            std::string s = spec + conv;
+            // 字符串可能比栈缓冲长，直接按实际长度格式化
+            std::string v = arg.type == BinaryLogAppender::ARG_STRING ? arg.s : std::to_string(arg.u);
+            std::vector<char> big(v.size() + 512);
+            if (stars.size() == 0)
+                len = snprintf(big.data(), big.size(), s.c_str(), v.c_str());
+            else if (stars.size() == 1)
+                len = snprintf(big.data(), big.size(), s.c_str(), w, v.c_str());
+            else
+                len = snprintf(big.data(), big.size(), s.c_str(), w, p, v.c_str());
+            if (len > 0)
+            {
+                out.append(big.data(), std::min((size_t)len, big.size() - 1));
+            }
+            len = 0;
+            break;
+        }
+        case 'p':
+        {
+            std::string s = spec + conv;
+            XX(s, (void *)(uintptr_t)arg.u);
+            break;
+        }
+        default:
+            out.append(fmt, begin, i + 1 - begin);
+            break;
+        }
+#undef XX
+        if (len > 0)
+        {
+            out.append(buf, std::min((size_t)len, sizeof(buf) - 1));
+        }
+    }
+}
+
+static void Usage(const char *name)
+{
+    std::cout << "usage: " << name << " [-p pattern] file" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    std::string pattern;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:h")) != -1)
+    {
+        if (opt == 'p')
+        {
+            pattern = optarg;
+        }
+        else
+        {
+            Usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind >= argc)
+    {
+        Usage(argv[0]);
+        return 1;
+    }
+    std::ifstream ifs(argv[optind], std::ios::binary);
+    if (!ifs)
+    {
+        std::cerr << "open " << argv[optind] << " failed" << std::endl;
+        return 1;
+    }
+    std::string content((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+
+    // 第一遍切块并收集定义，其他线程的数据块可能先于调用点定义落盘
+    struct Chunk
+    {
+        uint8_t type;
+        const char *data;
+        uint32_t size;
+    };
+    std::vector<Chunk> chunks;
+    std::unordered_map<uint32_t, Site> sites;
+    std::unordered_map<uint32_t, sake::Logger::ptr> loggers;
+    std::string first_pattern;
+    Reader reader(content.data(), content.size());
+    while (!reader.eof())
+    {
+        uint32_t magic = reader.get<uint32_t>();
+        Chunk chunk;
+        chunk.type = reader.get<uint8_t>();
+        chunk.size = reader.get<uint32_t>();
+        if (!reader.ok() || magic != BinaryLogAppender::MAGIC)
+        {
+            std::cerr << "bad chunk header, stop" << std::endl;
+            break;
+        }
+        chunk.data = reader.pos();
+        reader.skip(chunk.size);
+        if (!reader.ok())
+        {
+            std::cerr << "truncated chunk, stop" << std::endl;
+            break;
+        }
+        chunks.push_back(chunk);
+
+        Reader r(chunk.data, chunk.size);
+        if (chunk.type == BinaryLogAppender::CHUNK_SITE)
+        {
+            uint32_t id = r.get<uint32_t>();
+            Site &site = sites[id];
+            site.level = (sake::LogLevel::Level)r.get<uint8_t>();
+            int32_t line = r.get<int32_t>();
+            std::string file = r.str(r.get<uint16_t>());
+            site.fmt = r.str(r.get<uint32_t>());
+            std::string func = r.str(r.get<uint16_t>());
+            site.decoded.reset(new DecodedSite(file, line, func));
+        }
+        else if (chunk.type == BinaryLogAppender::CHUNK_LOGGER)
+        {
+            uint32_t id = r.get<uint32_t>();
+            loggers[id].reset(new sake::Logger(r.str(r.get<uint16_t>())));
+        }
+        else if (chunk.type == BinaryLogAppender::CHUNK_PATTERN && first_pattern.empty())
+        {
+            first_pattern = r.str(r.get<uint32_t>());
+        }
+    }
+
+    // 第二遍按文件顺序还原，格式模板取该数据块之前最近的一个
+    sake::LogFormatter::ptr formatter;
+    if (!pattern.empty())
+    {
+        formatter.reset(new sake::LogFormatter(pattern));
+    }
+    else if (!first_pattern.empty())
+    {
+        formatter.reset(new sake::LogFormatter(first_pattern));
+    }
+    else
+    {
+        formatter = sake::Logger().getLogFormatter();
+    }
+    if (formatter->isError())
+    {
+        std::cerr << "invalid pattern: " << formatter->getPattern() << std::endl;
+        return 1;
+    }
+    sake::Logger::ptr unknown(new sake::Logger("unknown"));
+    DecodedSite unknown_site("unknown", 0, "");
+    // 文本记录自带文件、行号和函数名，相同的共用一个调用点
+    std::unordered_map<std::string, std::unique_ptr<DecodedSite>> text_sites;
+    sake::LogEvent event;
+    sake::LogMdc mdc = sake::LogMdc();
+    std::string message;
+    std::string out;
+    std::vector<Arg> args;
+    for (auto &chunk : chunks)
+    {
+        Reader r(chunk.data, chunk.size);
+        if (chunk.type == BinaryLogAppender::CHUNK_PATTERN)
+        {
+            if (pattern.empty())
+            {
+                std::string p = r.str(r.get<uint32_t>());
+                if (p != formatter->getPattern())
+                {
+                    formatter.reset(new sake::LogFormatter(p));
+                }
+            }
+            continue;
+        }
+        if (chunk.type != BinaryLogAppender::CHUNK_DATA)
+        {
+            continue;
+        }
+        uint32_t tid = r.get<uint32_t>();
+        std::string thread_name = r.str(r.get<uint16_t>());
+        while (!r.eof() && r.ok())
+        {
+            uint8_t type = r.get<uint8_t>();
+            sake::LogLevel::Level level = (sake::LogLevel::Level)r.get<uint8_t>();
+            const Site *site = nullptr;
+            if (type == BinaryLogAppender::RECORD_FORMAT)
+            {
+                auto it = sites.find(r.get<uint32_t>());
+                site = it == sites.end() ? nullptr : &it->second;
+            }
+            else if (type != BinaryLogAppender::RECORD_TEXT)
+            {
+                std::cerr << "bad record type " << (int)type << ", skip chunk" << std::endl;
+                break;
+            }
+            auto logger_it = loggers.find(r.get<uint32_t>());
+            const sake::Logger::ptr &logger = logger_it == loggers.end() ? unknown : logger_it->second;
+            uint64_t time_us = r.get<uint64_t>();
+            uint32_t fiber_id = r.get<uint32_t>();
+            uint32_t elapse = r.get<uint32_t>();
+            mdc.clear();
+            uint8_t mdc_count = r.get<uint8_t>();
+            for (uint8_t i = 0; i < mdc_count && r.ok(); ++i)
+            {
+                std::string key = r.str(r.get<uint8_t>());
+                std::string value = r.str(r.get<uint8_t>());
+                mdc.push(key, value);
+            }
+            const sake::LogSite *log_site = &unknown_site.site;
+            message.clear();
+            if (type == BinaryLogAppender::RECORD_FORMAT)
+            {
+                args.resize(r.get<uint8_t>());
+                for (auto &arg : args)
+                {
+                    arg.type = r.get<uint8_t>();
+                    if (arg.type == BinaryLogAppender::ARG_DOUBLE)
+                    {
+                        arg.d = r.get<double>();
+                    }
+                    else if (arg.type == BinaryLogAppender::ARG_STRING)
+                    {
+                        arg.s = r.str(r.get<uint32_t>());
+                    }
+                    else
+                    {
+                        arg.u = r.get<uint64_t>();
+                    }
+                }
+                if (site)
+                {
+                    log_site = &site->decoded->site;
+                    RenderFormat(message, site->fmt, args);
+                }
+                else
+                {
+                    message = "<<unknown site>>";
+                }
+            }
+            else
+            {
+                int32_t line = r.get<int32_t>();
+                std::string file = r.str(r.get<uint16_t>());
+                std::string func = r.str(r.get<uint16_t>());
+                message = r.str(r.get<uint32_t>());
+                std::unique_ptr<DecodedSite> &decoded = text_sites[file + ':' + std::to_string(line) + ':' + func];
+                if (!decoded)
+                {
+                    decoded.reset(new DecodedSite(file, line, func));
+                }
+                log_site = &decoded->site;
+            }
+            if (!r.ok())
+            {
+                std::cerr << "truncated record, skip chunk" << std::endl;
+                break;
+            }
+            event.reset(logger, level, log_site, elapse, tid, fiber_id, time_us, thread_name);
+            event.setMdc(mdc);
+            event.getSS().write(message.data(), message.size());
+            if (type == BinaryLogAppender::RECORD_TEXT)
+            {
+                // 结构化字段：u8 type, u16+key, 8字节值或u32+字符串
+                uint8_t count = r.get<uint8_t>();
+                for (uint8_t i = 0; i < count && r.ok(); ++i)
+                {
+                    uint8_t field_type = r.get<uint8_t>();
+                    std::string key = r.str(r.get<uint16_t>());
+                    if (field_type == sake::LogEvent::FIELD_STRING)
+                    {
+                        std::string v = r.str(r.get<uint32_t>());
+                        event.addField(key.c_str(), v);
+                        continue;
+                    }
+                    uint64_t v = r.get<uint64_t>();
+                    if (field_type == sake::LogEvent::FIELD_INT)
+                    {
+                        event.addField(key.c_str(), (int64_t)v);
+                    }
+                    else if (field_type == sake::LogEvent::FIELD_DOUBLE)
+                    {
+                        double d;
+                        memcpy(&d, &v, sizeof(d));
+                        event.addField(key.c_str(), d);
+                    }
+                    else if (field_type == sake::LogEvent::FIELD_BOOL)
+                    {
+                        event.addField(key.c_str(), v != 0);
+                    }
+                    else
+                    {
+                        event.addField(key.c_str(), v);
+                    }
+                }
+            }
+            out.clear();
+            formatter->format(out, level, event);
+            std::cout.write(out.data(), out.size());
+        }
+    }
+    return 0;
+}
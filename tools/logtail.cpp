@@ -0,0 +1,87 @@
+// 实时读取ShmLogAppender的共享内存环形缓冲，只读附加，不影响写者
+// 用法: sake_logtail [-f] [-n lines] name
+#include "log.h"
+#include <stdio.h>
+#include <unistd.h>
+
+// 没有新记录时的轮询间隔
+static const useconds_t s_poll_us = 10 * 1000;
+// 下一条记录一直没写完(写者在写入中途退出)时，等这么多次后跳过
+static const int s_max_busy = 100;
+
+static void Usage(const char *name)
+{
+    std::cerr << "usage: " << name << " [-f] [-n lines] name" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    bool follow = false;
+    size_t lines = 10;
+    int opt;
+    while ((opt = getopt(argc, argv, "fn:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'f':
+            follow = true;
+            break;
+        case 'n':
+            lines = strtoull(optarg, nullptr, 10);
+            break;
+        default:
+            Usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind + 1 != argc)
+    {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    sake::ShmLogReader reader;
+    if (!reader.open(argv[optind]))
+    {
+        return 1;
+    }
+    // -n 0 表示只看新写入的记录
+    if (lines)
+    {
+        reader.seekOldest(lines);
+    }
+
+    std::string line;
+    uint64_t lost = 0;
+    int busy = 0;
+    while (true)
+    {
+        sake::ShmLogReader::Result rt = reader.read(line);
+        if (reader.getLost() != lost)
+        {
+            fflush(stdout);
+            std::cerr << "[sake_logtail] lost " << reader.getLost() - lost << " bytes" << std::endl;
+            lost = reader.getLost();
+        }
+        if (rt == sake::ShmLogReader::READ_OK)
+        {
+            fwrite(line.data(), 1, line.size(), stdout);
+            busy = 0;
+            continue;
+        }
+        if (rt == sake::ShmLogReader::READ_BUSY && ++busy >= s_max_busy)
+        {
+            reader.resync();
+            busy = 0;
+            continue;
+        }
+        if (rt == sake::ShmLogReader::READ_EMPTY && !follow)
+        {
+            break;
+        }
+        fflush(stdout);
+        usleep(rt == sake::ShmLogReader::READ_BUSY ? s_poll_us / 10 : s_poll_us);
+    }
+    fflush(stdout);
+    return 0;
+}